@@ -0,0 +1,104 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Arenas.  Memory is handed out from a chain of large chunks by
+  bumping a pointer, and is never freed piece by piece: arena_reset()
+  gives all of it back at once by rewinding to the first chunk.  The
+  chunks are kept and refilled, so a program reloaded thousands of
+  times reuses the same memory instead of growing the heap.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "sim.h"
+
+#define ARENA_CHUNK (64 * 1024)
+#define ARENA_ALIGN 8
+
+struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;
+  char data[];
+};
+
+static struct arena_chunk *new_chunk(size_t size) {
+  struct arena_chunk *c;
+
+  if (size < ARENA_CHUNK)
+    size = ARENA_CHUNK;
+  c = malloc(sizeof(struct arena_chunk) + size);
+  if (!c) {
+    perror("malloc failed"); exit(1);
+  }
+  c->next = NULL;
+  c->size = size;
+  return c;
+}
+
+void *arena_alloc(struct arena *a, size_t size) {
+  struct arena_chunk *c;
+  void *p;
+
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if (!a->current || a->used + size > a->current->size) {
+    //move on to the next kept chunk, or put a big enough one before it
+    c = a->current ? a->current->next : a->first;
+    if (!c || c->size < size) {
+      struct arena_chunk *n = new_chunk(size);
+      n->next = c;
+      if (a->current)
+        a->current->next = n;
+      else
+        a->first = n;
+      c = n;
+    }
+    a->current = c;
+    a->used = 0;
+  }
+
+  p = a->current->data + a->used;
+  a->used += size;
+  return p;
+}
+
+char *arena_printf(struct arena *a, const char *format, ...) {
+  va_list ap;
+  int len;
+  char *s;
+
+  va_start(ap, format);
+  len = vsnprintf(NULL, 0, format, ap);
+  va_end(ap);
+
+  s = arena_alloc(a, len + 1);
+  va_start(ap, format);
+  vsnprintf(s, len + 1, format, ap);
+  va_end(ap);
+  return s;
+}
+
+/*
+  Releases everything allocated from a.  The chunks stay with the
+  arena for the next allocations.
+ */
+void arena_reset(struct arena *a) {
+  a->current = NULL;
+  a->used = 0;
+}
+
+void arena_free(struct arena *a) {
+  struct arena_chunk *c = a->first, *next;
+
+  while (c) {
+    next = c->next;
+    free(c);
+    c = next;
+  }
+  a->first = a->current = NULL;
+  a->used = 0;
+}
@@ -0,0 +1,89 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Benchmark mode (-b N).  Loads, resets and runs the program N times
+  without any output, measures raw decoder throughput, and prints a
+  single JSON object with the mean timings, so bench/run.sh can
+  collect one line per program.  With a branch predictor (-p) the
+  object also carries its misprediction rate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "sim.h"
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+  Decoder micro-benchmark: decodes the loaded program's lines over
+  and over for at least 100ms and returns lines decoded per second.
+ */
+static double bench_decode(struct ami_machine *m) {
+  struct stack_entry entry;
+  unsigned long lines = 0;
+  int reg_count = 1;
+  double start = now(), elapsed;
+  int i;
+
+  do {
+    for (i = 0; i < m->slots_used; i++)
+      decode_instr(m->mem[i].instruction, &entry, &reg_count);
+    lines += m->slots_used;
+  } while ((elapsed = now() - start) < 0.1);
+
+  return lines / elapsed;
+}
+
+void run_benchmark(struct ami_machine *m, int reps) {
+  double load = 0, reset = 0, elapsed = 0, decode, t;
+  unsigned long instructions = 0;
+  struct rusage usage;
+  int i;
+
+  for (i = 0; i < reps; i++) {
+    t = now();
+    free_segments(m);
+    allocate_stack(m);
+    load += now() - t;
+  }
+
+  for (i = 0; i < reps; i++) {
+    t = now();
+    reset_machine(m);
+    reset += now() - t;
+
+    //programs that read input get the same input on every run
+    rewind(stdin);
+
+    t = now();
+    run(m, 0);
+    elapsed += now() - t;
+    instructions += m->icount;
+  }
+
+  decode = bench_decode(m);
+  getrusage(RUSAGE_SELF, &usage);
+
+  printf("{\"program\": \"%s\", \"lines\": %u, \"lazy\": %d, \"reps\": %d, "
+         "\"instructions\": %lu, \"run_s\": %.6f, \"mips\": %.2f, "
+         "\"load_us\": %.2f, \"reset_us\": %.2f, \"decode_mlps\": %.2f, "
+         "\"peak_rss_kb\": %ld",
+         m->filename, m->slots_used, m->opt_lazy, reps,
+         instructions / reps, elapsed / reps,
+         elapsed > 0 ? instructions / elapsed / 1e6 : 0,
+         load / reps * 1e6, reset / reps * 1e6, decode / 1e6, usage.ru_maxrss);
+  if (m->bpred)
+    printf(", \"predictor\": \"%s\", \"branches\": %lu, \"mispredict_pct\": %.2f",
+           bpred_name(m->bpred->kind), m->bpred->branches / reps,
+           m->bpred->branches ? 100.0 * m->bpred->mispredicts / m->bpred->branches : 0.0);
+  printf("}\n");
+}
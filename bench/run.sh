@@ -0,0 +1,15 @@
+#!/bin/sh
+# Runs every program in bench/ under the simulator's benchmark mode
+# and prints one JSON object per program.  A program named foo.ami
+# reads its input from foo.in when that file exists.
+#
+#   REPS=20 sh bench/run.sh > results.jsonl
+
+cd "$(dirname "$0")/.." || exit 1
+REPS=${REPS:-10}
+
+for prog in bench/*.ami; do
+  input=${prog%.ami}.in
+  [ -f "$input" ] || input=/dev/null
+  ./sim -b "$REPS" "$prog" < "$input" || exit 1
+done
@@ -0,0 +1,177 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Control flow of the loaded program.  Constant jump targets are
+  resolved to slot numbers, and the slots holding instructions are
+  recorded in a bitmap that targets computed at run time are checked
+  against.
+
+  Basic blocks.  The loaded program is split after every jump and
+  halt and before every constant jump target, so control only leaves
+  a block from its last instruction.  The engine makes its halt,
+  breakpoint, checkpoint and step budget checks once per block
+  instead of once per instruction.
+
+  Jumps computed from registers may still land in the middle of a
+  block; the engine then runs from there to the end of the block.
+
+  With lazy decoding (-l) the loader only finds the lines of the
+  program.  Blocks are then discovered, decoded and verified one at a
+  time by discover_block() when the engine first enters them, so a
+  block found this way may later turn out to contain a jump target.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+static int ends_block(struct stack_entry *e) {
+  return e->op == JUMP || e->op == JUMPIF || e->op == JUMPNIF || e->op == HALT;
+}
+
+/*
+  Sets e->target to the slot a jump with a constant target goes to.
+  Out of range constants are left to fault when they are reached.
+ */
+static void resolve_target(struct ami_machine *m, struct stack_entry *e) {
+  int target;
+
+  e->target = -1;
+  if (ends_block(e) && e->op != HALT && constant_target(&e->arguments[0], &target)
+      && target >= 0 && target < m->slots_used)
+    e->target = target;
+}
+
+static void mark_valid(struct ami_machine *m) {
+  unsigned int pc;
+
+  memset(m->valid_pc, 0, sizeof(m->valid_pc));
+  for (pc = 0; pc < m->slots_used; pc++)
+    m->valid_pc[pc >> 3] |= 1 << (pc & 7);
+}
+
+void build_blocks(struct ami_machine *m) {
+  static unsigned char leader[STACK_SIZE];
+  unsigned int pc;
+
+  memset(leader, 0, sizeof(leader));
+  leader[0] = 1;
+  mark_valid(m);
+
+  for (pc = 0; pc < m->slots_used; pc++) {
+    struct stack_entry *e = &m->mem[pc];
+    resolve_target(m, e);
+    if (!ends_block(e))
+      continue;
+    if (pc + 1 < m->slots_used)
+      leader[pc + 1] = 1;
+    if (e->target >= 0)
+      leader[e->target] = 1;
+  }
+
+  m->block_count = 0;
+  for (pc = 0; pc < m->slots_used; pc++) {
+    if (leader[pc]) {
+      struct block *b = &m->blocks[m->block_count++];
+      b->start = pc;
+      b->breakpoints = 0;
+      b->entries = 0;
+    }
+    m->block_of[pc] = m->block_count - 1;
+    m->blocks[m->block_count - 1].end = pc + 1;
+  }
+
+  mark_breakpoint_blocks(m);
+}
+
+/*
+  Drops all blocks, leaving every slot to be decoded by
+  discover_block()
+ */
+void forget_blocks(struct ami_machine *m) {
+  unsigned int pc;
+
+  m->block_count = 0;
+  for (pc = 0; pc < STACK_SIZE; pc++)
+    m->block_of[pc] = NO_BLOCK;
+  mark_valid(m);
+}
+
+/*
+  Decodes the block starting at pc, which must be the PC, up to its
+  first jump or halt, or the first slot already decoded.  A bad
+  instruction ends the block before it, so it faults (with the PC
+  pointing at it) when it is reached.
+ */
+void discover_block(struct ami_machine *m, unsigned int pc) {
+  struct block *b = &m->blocks[m->block_count];
+  struct breakpoint *bp;
+  char *error;
+
+  b->start = pc;
+  b->breakpoints = 0;
+  b->entries = 0;
+
+  for (; pc < m->slots_used && m->block_of[pc] == NO_BLOCK; pc++) {
+    struct stack_entry *e = &m->mem[pc];
+    decode_instr(e->instruction, e, &m->reg_count);
+    e->data_type = INSTRUCTION;
+    if ((error = instruction_error(m, e))) {
+      if (pc == b->start)
+        raise(m, error);
+      break;
+    }
+    resolve_target(m, e);
+    m->block_of[pc] = m->block_count;
+    if (ends_block(e)) {
+      pc++;
+      break;
+    }
+  }
+  b->end = pc;
+
+  for (bp = m->breakpoints; bp != NULL; bp = bp->next)
+    if (bp->addr > b->start && bp->addr < b->end)
+      b->breakpoints = 1;
+
+  m->block_count++;
+}
+
+/*
+  Flags the blocks that must be run one instruction at a time because
+  a breakpoint is set inside them.  A breakpoint on the first
+  instruction is seen when the block is entered.  Called whenever a
+  breakpoint is added or deleted.
+ */
+void mark_breakpoint_blocks(struct ami_machine *m) {
+  struct breakpoint *bp;
+  unsigned int i;
+
+  for (i = 0; i < m->block_count; i++)
+    m->blocks[i].breakpoints = 0;
+
+  for (bp = m->breakpoints; bp != NULL; bp = bp->next) {
+    if (bp->addr < m->slots_used && m->block_of[bp->addr] != NO_BLOCK) {
+      struct block *b = &m->blocks[m->block_of[bp->addr]];
+      if (bp->addr > b->start)
+        b->breakpoints = 1;
+    }
+  }
+}
+
+void dump_blocks(struct ami_machine *m) {
+  unsigned int i;
+
+  if (m->block_count == 0)
+    printf("no program loaded\n");
+
+  for (i = 0; i < m->block_count; i++) {
+    struct block *b = &m->blocks[i];
+    printf("block %3u  %4u-%-4u  %10lu entries%s\n", i, b->start, b->end - 1,
+           b->entries, b->breakpoints ? "  (has breakpoints)" : "");
+  }
+}
@@ -0,0 +1,218 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Branch predictor model.  Each conditional jump the program runs is
+  predicted by one of
+
+    static   backward jumps taken, forward jumps not taken
+    1bit     a table of last outcomes indexed by PC
+    2bit     a table of saturating counters indexed by PC
+    gshare   saturating counters indexed by PC xor the global history
+             of recent outcomes
+
+  and the prediction is compared with what the jump did.  With a
+  branch target buffer, a jump predicted taken whose target is not
+  in the buffer also counts as mispredicted, since fetch could not
+  have been redirected.
+
+  The engine reports conditional jumps only in its hooked variant,
+  which is selected while a predictor is on.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define BPRED_REPORT_PCS 16
+
+static char *kind_names[] = { "static", "1bit", "2bit", "gshare" };
+
+int bpred_kind(char *name) {
+  int i;
+  for (i = 0; i < sizeof(kind_names) / sizeof(kind_names[0]); i++)
+    if (!strcmp(name, kind_names[i]))
+      return i;
+  return -1;
+}
+
+char *bpred_name(int kind) {
+  return kind_names[kind];
+}
+
+/*
+  entries is rounded up to a power of two.  btb_entries of 0 leaves
+  out the branch target buffer.
+ */
+struct bpred *bpred_create(int kind, unsigned int entries, unsigned int btb_entries,
+                           unsigned int btb_assoc) {
+  struct bpred *b = calloc(1, sizeof(struct bpred));
+  unsigned int size = 1;
+
+  if (!b)
+    return NULL;
+  while (size < entries)
+    size <<= 1;
+  b->kind = kind;
+  b->entries = size;
+  b->counters = malloc(size);
+
+  if (btb_entries > 0) {
+    b->btb_assoc = btb_assoc > 0 && btb_assoc <= btb_entries ? btb_assoc : 1;
+    b->btb_sets = btb_entries / b->btb_assoc;
+    b->btb = malloc(b->btb_sets * b->btb_assoc * sizeof(struct btb_entry));
+  }
+
+  if (!b->counters || (btb_entries > 0 && !b->btb)) {
+    bpred_free(b);
+    return NULL;
+  }
+  bpred_clear(b);
+  return b;
+}
+
+void bpred_free(struct bpred *b) {
+  if (b) {
+    free(b->counters);
+    free(b->btb);
+    free(b);
+  }
+}
+
+void bpred_clear(struct bpred *b) {
+  //counters start weakly not taken
+  memset(b->counters, b->kind == BPRED_ONEBIT ? 0 : 1, b->entries);
+  if (b->btb)
+    memset(b->btb, 0, b->btb_sets * b->btb_assoc * sizeof(struct btb_entry));
+  b->history = 0;
+  b->btb_clock = 0;
+  b->branches = b->mispredicts = b->btb_misses = 0;
+  memset(b->pc, 0, sizeof(b->pc));
+}
+
+/*
+  Looks up pc in the BTB, and on a taken jump records its target.
+  Returns whether the buffer held the right target before.
+ */
+static int btb_access(struct bpred *b, unsigned int pc, int taken, unsigned int target) {
+  struct btb_entry *ways = &b->btb[(pc % b->btb_sets) * b->btb_assoc], *victim = ways;
+  unsigned int w;
+
+  for (w = 0; w < b->btb_assoc; w++) {
+    if (ways[w].valid && ways[w].pc == pc) {
+      int hit = ways[w].target == target;
+      ways[w].stamp = ++b->btb_clock;
+      if (taken)
+        ways[w].target = target;
+      return hit;
+    }
+    if (!ways[w].valid || (victim->valid && ways[w].stamp < victim->stamp))
+      victim = &ways[w];
+  }
+
+  if (taken) {
+    victim->valid = 1;
+    victim->pc = pc;
+    victim->target = target;
+    victim->stamp = ++b->btb_clock;
+  }
+  return 0;
+}
+
+void bpred_branch(struct ami_machine *m, unsigned int pc, int taken, unsigned int target) {
+  struct bpred *b = m->bpred;
+  unsigned int index = pc & (b->entries - 1);
+  unsigned char *counter;
+  int predicted, miss;
+
+  if (b->kind == BPRED_GSHARE)
+    index = (pc ^ b->history) & (b->entries - 1);
+  counter = &b->counters[index];
+
+  switch (b->kind) {
+  case BPRED_STATIC:
+    predicted = target <= pc;
+    break;
+  case BPRED_ONEBIT:
+    predicted = *counter;
+    *counter = taken;
+    break;
+  default:
+    predicted = *counter >= 2;
+    if (taken && *counter < 3)
+      (*counter)++;
+    else if (!taken && *counter > 0)
+      (*counter)--;
+  }
+  b->history = (b->history << 1) | (taken != 0);
+
+  miss = predicted != taken;
+  if (b->btb && !btb_access(b, pc, taken, target) && predicted && taken) {
+    b->btb_misses++;
+    miss = 1;
+  }
+
+  b->last_miss = miss;
+  b->branches++;
+  b->mispredicts += miss;
+  if (pc < STACK_SIZE) {
+    b->pc[pc].count++;
+    b->pc[pc].taken += taken != 0;
+    b->pc[pc].mispredicts += miss;
+  }
+}
+
+static struct bpred *sort_bpred;
+
+//most mispredictions first
+static int compare_pcs(const void *a, const void *b) {
+  unsigned long ma = sort_bpred->pc[*(const unsigned int *)a].mispredicts;
+  unsigned long mb = sort_bpred->pc[*(const unsigned int *)b].mispredicts;
+  return ma < mb ? 1 : ma > mb ? -1 : 0;
+}
+
+static double percent(unsigned long part, unsigned long whole) {
+  return whole ? 100.0 * part / whole : 0.0;
+}
+
+void dump_bpred(struct ami_machine *m) {
+  struct bpred *b = m->bpred;
+  unsigned int *pcs, n = 0, pc, i;
+
+  if (!b) {
+    printf("branch prediction is off\n");
+    return;
+  }
+
+  printf("%s predictor, %u entries", bpred_name(b->kind), b->entries);
+  if (b->btb)
+    printf(", %u entry %u-way BTB", b->btb_sets * b->btb_assoc, b->btb_assoc);
+  printf("\n%lu conditional jumps, %lu mispredicted (%.2f%%)", b->branches,
+         b->mispredicts, percent(b->mispredicts, b->branches));
+  if (b->btb)
+    printf(", %lu for want of a BTB entry", b->btb_misses);
+  printf("\n");
+
+  pcs = malloc(STACK_SIZE * sizeof(unsigned int));
+  if (!pcs)
+    return;
+  for (pc = 0; pc < STACK_SIZE; pc++)
+    if (b->pc[pc].count)
+      pcs[n++] = pc;
+  sort_bpred = b;
+  qsort(pcs, n, sizeof(unsigned int), compare_pcs);
+
+  if (n > 0)
+    printf("\n  pc       count    taken  accuracy  instruction\n");
+  for (i = 0; i < n && i < BPRED_REPORT_PCS; i++) {
+    pc = pcs[i];
+    printf("%4u  %10lu  %6.2f%%  %7.2f%%  %s\n", pc, b->pc[pc].count,
+           percent(b->pc[pc].taken, b->pc[pc].count),
+           100.0 - percent(b->pc[pc].mispredicts, b->pc[pc].count),
+           m->mem[pc].instruction ? m->mem[pc].instruction : "");
+  }
+  free(pcs);
+}
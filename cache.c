@@ -0,0 +1,229 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Cache hierarchy model.  Every data access the program makes goes
+  through up to MAX_CACHE_LEVELS set-associative caches, each with
+  its own size, line size, associativity, replacement (LRU or FIFO)
+  and write policy:
+
+    write back     a write hit marks the line dirty; a write miss
+                   fetches the line; dirty lines are written to the
+                   next level when evicted
+    write through  a write is passed on to the next level; a write
+                   miss does not fetch the line
+
+  The model only counts hits and misses; the values themselves stay
+  in m->mem.  Accesses are seen by the accessors of the hooked
+  engine, which is only selected while a cache is configured, so the
+  plain engine pays nothing for it.  Replayed instructions, as in
+  reverse-step, are counted again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define CACHE_REPORT_PCS 16
+
+/*
+  Adds a level below the existing ones.  Returns 0, or -1 with a
+  message if the geometry does not make sense.
+ */
+int cache_add_level(struct ami_machine *m, unsigned int size, unsigned int line,
+                    unsigned int assoc, int replace, int write_back) {
+  struct cache_level *l;
+
+  if (size == 0 || line == 0 || assoc == 0 || size % (line * assoc)) {
+    printf("cache size must be a multiple of line size times associativity\n");
+    return -1;
+  }
+  if (!m->cache) {
+    m->cache = calloc(1, sizeof(struct cache));
+    if (!m->cache) {
+      printf("out of memory\n");
+      return -1;
+    }
+  }
+  if (m->cache->levels == MAX_CACHE_LEVELS) {
+    printf("at most %d cache levels\n", MAX_CACHE_LEVELS);
+    return -1;
+  }
+
+  l = &m->cache->level[m->cache->levels];
+  memset(l, 0, sizeof(*l));
+  l->size = size;
+  l->line = line;
+  l->assoc = assoc;
+  l->sets = size / (line * assoc);
+  l->replace = replace;
+  l->write_back = write_back;
+  l->lines = calloc(l->sets * assoc, sizeof(struct cache_line));
+  if (!l->lines) {
+    printf("out of memory\n");
+    return -1;
+  }
+  m->cache->levels++;
+  select_engine(m);
+  return 0;
+}
+
+void cache_off(struct ami_machine *m) {
+  int i;
+
+  if (!m->cache)
+    return;
+  for (i = 0; i < m->cache->levels; i++)
+    free(m->cache->level[i].lines);
+  free(m->cache);
+  m->cache = NULL;
+  select_engine(m);
+}
+
+/*
+  Empties every level and zeroes the statistics
+ */
+void cache_clear(struct cache *c) {
+  int i;
+  struct cache_level *l;
+
+  for (i = 0; i < c->levels; i++) {
+    l = &c->level[i];
+    memset(l->lines, 0, l->sets * l->assoc * sizeof(struct cache_line));
+    l->reads = l->read_misses = l->writes = l->write_misses = l->writebacks = 0;
+  }
+  memset(c->pc, 0, sizeof(c->pc));
+  c->clock = 0;
+}
+
+static void level_access(struct cache *c, int i, unsigned int addr, int write,
+                         unsigned int pc) {
+  struct cache_level *l;
+  struct cache_line *ways, *victim;
+  unsigned int block, set, tag, w;
+
+  if (i == c->levels)
+    return;//main memory
+
+  l = &c->level[i];
+  block = addr / l->line;
+  set = block % l->sets;
+  tag = block / l->sets;
+  ways = &l->lines[set * l->assoc];
+
+  if (write)
+    l->writes++;
+  else
+    l->reads++;
+
+  for (w = 0; w < l->assoc; w++) {
+    if (ways[w].valid && ways[w].tag == tag) {
+      if (l->replace == CACHE_LRU)
+        ways[w].stamp = ++c->clock;
+      if (write && l->write_back)
+        ways[w].dirty = 1;
+      else if (write)
+        level_access(c, i + 1, addr, 1, pc);
+      return;
+    }
+  }
+
+  if (write)
+    l->write_misses++;
+  else
+    l->read_misses++;
+  if (pc < STACK_SIZE)
+    c->pc[pc].misses[i]++;
+
+  if (write && !l->write_back) {
+    level_access(c, i + 1, addr, 1, pc);
+    return;
+  }
+
+  //an empty way, else the oldest
+  victim = &ways[0];
+  for (w = 0; w < l->assoc; w++) {
+    if (!ways[w].valid) {
+      victim = &ways[w];
+      break;
+    }
+    if (ways[w].stamp < victim->stamp)
+      victim = &ways[w];
+  }
+
+  if (victim->valid && victim->dirty) {
+    l->writebacks++;
+    level_access(c, i + 1, (victim->tag * l->sets + set) * l->line, 1, pc);
+  }
+  level_access(c, i + 1, addr, 0, pc);
+
+  victim->tag = tag;
+  victim->valid = 1;
+  victim->dirty = write;
+  victim->stamp = ++c->clock;
+}
+
+void cache_access(struct ami_machine *m, unsigned int addr, int write) {
+  struct cache *c = m->cache;
+
+  if (m->PC < STACK_SIZE)
+    c->pc[m->PC].accesses++;
+  level_access(c, 0, addr, write, m->PC);
+}
+
+static struct cache *sort_cache;
+
+//more misses in the first level first
+static int compare_pcs(const void *a, const void *b) {
+  unsigned long ma = sort_cache->pc[*(const unsigned int *)a].misses[0];
+  unsigned long mb = sort_cache->pc[*(const unsigned int *)b].misses[0];
+  return ma < mb ? 1 : ma > mb ? -1 : 0;
+}
+
+static double percent(unsigned long part, unsigned long whole) {
+  return whole ? 100.0 * part / whole : 0.0;
+}
+
+void dump_cache(struct ami_machine *m) {
+  struct cache *c = m->cache;
+  struct cache_level *l;
+  unsigned int *pcs, n = 0, pc;
+  int i;
+
+  if (!c) {
+    printf("no cache configured\n");
+    return;
+  }
+
+  printf("level   size  line  assoc  policy      reads   misses      writes   misses  writebacks  miss rate\n");
+  for (i = 0; i < c->levels; i++) {
+    l = &c->level[i];
+    printf("L%-4d %6u %5u %6u  %s/%s %10lu %8lu  %10lu %8lu  %10lu  %8.2f%%\n",
+           i + 1, l->size, l->line, l->assoc,
+           l->replace == CACHE_LRU ? "lru " : "fifo", l->write_back ? "wb" : "wt",
+           l->reads, l->read_misses, l->writes, l->write_misses, l->writebacks,
+           percent(l->read_misses + l->write_misses, l->reads + l->writes));
+  }
+
+  pcs = malloc(STACK_SIZE * sizeof(unsigned int));
+  if (!pcs)
+    return;
+  for (pc = 0; pc < STACK_SIZE; pc++)
+    if (c->pc[pc].accesses)
+      pcs[n++] = pc;
+  sort_cache = c;
+  qsort(pcs, n, sizeof(unsigned int), compare_pcs);
+
+  if (n > 0)
+    printf("\n  pc    accesses  L1 miss rate  instruction\n");
+  for (i = 0; i < n && i < CACHE_REPORT_PCS; i++) {
+    pc = pcs[i];
+    printf("%4u  %10lu      %7.2f%%  %s\n", pc, c->pc[pc].accesses,
+           percent(c->pc[pc].misses[0], c->pc[pc].accesses),
+           m->mem[pc].instruction ? m->mem[pc].instruction : "");
+  }
+  free(pcs);
+}
@@ -0,0 +1,264 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Breakpoint conditions.  An expression such as
+
+    r3 > 1000 and c[b + 4] /= 0
+
+  is parsed once, when the breakpoint is set, into a short postfix
+  program for a small stack machine.  Evaluating it when the
+  breakpoint address is reached is then a single pass over an array
+  of integers with no parsing or allocation.
+
+  Grammar, loosest binding first:
+
+    expr    := and { ('or' | '||') and }
+    and     := cmp { ('and' | '&&') cmp }
+    cmp     := sum [ ('=' | '==' | '/=' | '!=' | '<' | '<=' | '>' | '>=') sum ]
+    sum     := term { ('+' | '-') term }
+    term    := unary { ('*' | '/') unary }
+    unary   := ('not' | '!' | '-') unary | primary
+    primary := NUMBER | 'r'N | 'b' | 'pc' | 'c[' expr ']' | '(' expr ')'
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "sim.h"
+
+enum {
+  C_CONST, C_REG, C_PC, C_MEM, C_NOT, C_NEG,
+  C_OR, C_AND, C_EQ, C_NEQ, C_LT, C_LTE, C_GT, C_GTE,
+  C_ADD, C_SUB, C_MULT, C_DIV
+};
+
+struct parser {
+  char *s;//unparsed text
+  struct cond *c;
+  int depth;//current evaluation stack depth
+  char *error;
+};
+
+static void emit(struct parser *p, int op, int operand, int push) {
+  struct cond *c = p->c;
+
+  if (c->len + 2 > MAX_COND_CODE) {
+    p->error = "condition is too long";
+    return;
+  }
+
+  c->code[c->len++] = op;
+  if (op == C_CONST || op == C_REG)
+    c->code[c->len++] = operand;
+
+  p->depth += push;
+  if (p->depth > c->max_depth)
+    c->max_depth = p->depth;
+}
+
+static void skip_space(struct parser *p) {
+  while (isspace(*p->s))
+    p->s++;
+}
+
+/*
+  Consumes word if the text continues with it; words ending in a
+  letter must not run into a following letter or digit.
+ */
+static int accept(struct parser *p, char *word) {
+  int len = strlen(word);
+
+  skip_space(p);
+  if (strncmp(p->s, word, len))
+    return 0;
+  if (isalpha(word[len - 1]) && isalnum(p->s[len]))
+    return 0;
+  p->s += len;
+  return 1;
+}
+
+static void parse_expr(struct parser *p);
+
+static void parse_primary(struct parser *p) {
+  skip_space(p);
+
+  if (isdigit(*p->s)) {
+    emit(p, C_CONST, strtol(p->s, &p->s, 10), 1);
+  } else if (accept(p, "(")) {
+    parse_expr(p);
+    if (!accept(p, ")"))
+      p->error = "expected ')'";
+  } else if (accept(p, "c[")) {
+    parse_expr(p);
+    if (!accept(p, "]"))
+      p->error = "expected ']'";
+    emit(p, C_MEM, 0, 0);
+  } else if (accept(p, "pc")) {
+    emit(p, C_PC, 0, 1);
+  } else if (accept(p, "b")) {
+    emit(p, C_REG, 0, 1);
+  } else if (*p->s == 'r' && isdigit(p->s[1])) {
+    int reg = strtol(p->s + 1, &p->s, 10);
+    if (reg >= MAX_REGISTERS)
+      p->error = "no such register";
+    emit(p, C_REG, reg, 1);
+  } else {
+    p->error = "expected a number, register, c[address] or '('";
+  }
+}
+
+static void parse_unary(struct parser *p) {
+  if (accept(p, "not") || accept(p, "!")) {
+    parse_unary(p);
+    emit(p, C_NOT, 0, 0);
+  } else if (accept(p, "-")) {
+    parse_unary(p);
+    emit(p, C_NEG, 0, 0);
+  } else {
+    parse_primary(p);
+  }
+}
+
+static void parse_term(struct parser *p) {
+  parse_unary(p);
+  while (!p->error) {
+    int op;
+    if (accept(p, "*")) op = C_MULT;
+    else if (accept(p, "/=")) { p->s -= 2; break; }
+    else if (accept(p, "/")) op = C_DIV;
+    else break;
+    parse_unary(p);
+    emit(p, op, 0, -1);
+  }
+}
+
+static void parse_sum(struct parser *p) {
+  parse_term(p);
+  while (!p->error) {
+    int op;
+    if (accept(p, "+")) op = C_ADD;
+    else if (accept(p, "-")) op = C_SUB;
+    else break;
+    parse_term(p);
+    emit(p, op, 0, -1);
+  }
+}
+
+static void parse_cmp(struct parser *p) {
+  int op;
+
+  parse_sum(p);
+  if (p->error)
+    return;
+
+  //two character operators must be tried before their prefixes
+  if (accept(p, "==") || accept(p, "=")) op = C_EQ;
+  else if (accept(p, "/=") || accept(p, "!=")) op = C_NEQ;
+  else if (accept(p, "<=")) op = C_LTE;
+  else if (accept(p, "<")) op = C_LT;
+  else if (accept(p, ">=")) op = C_GTE;
+  else if (accept(p, ">")) op = C_GT;
+  else return;
+
+  parse_sum(p);
+  emit(p, op, 0, -1);
+}
+
+static void parse_and(struct parser *p) {
+  parse_cmp(p);
+  while (!p->error && (accept(p, "and") || accept(p, "&&"))) {
+    parse_cmp(p);
+    emit(p, C_AND, 0, -1);
+  }
+}
+
+static void parse_expr(struct parser *p) {
+  parse_and(p);
+  while (!p->error && (accept(p, "or") || accept(p, "||"))) {
+    parse_and(p);
+    emit(p, C_OR, 0, -1);
+  }
+}
+
+/*
+  Compiles text into a condition.  Returns NULL and prints a message
+  if the text is not a valid expression.
+ */
+struct cond *cond_compile(char *text) {
+  struct parser p;
+
+  p.s = text;
+  p.c = calloc(sizeof(struct cond), 1);
+  p.depth = 0;
+  p.error = NULL;
+
+  parse_expr(&p);
+  skip_space(&p);
+  if (!p.error && *p.s)
+    p.error = "unexpected text";
+  if (!p.error && p.c->max_depth > MAX_COND_STACK)
+    p.error = "condition is nested too deeply";
+
+  if (p.error) {
+    printf("bad condition at '%s': %s\n", p.s, p.error);
+    free(p.c);
+    return NULL;
+  }
+
+  p.c->text = strdup(text);
+  return p.c;
+}
+
+void cond_free(struct cond *c) {
+  if (c) {
+    free(c->text);
+    free(c);
+  }
+}
+
+int cond_eval(struct ami_machine *m, struct cond *c) {
+  int stack[MAX_COND_STACK];
+  int *sp = stack, *pc = c->code, *end = c->code + c->len;
+  int a;
+
+  while (pc < end) {
+    switch (*pc++) {
+    case C_CONST: *sp++ = *pc++; break;
+    case C_REG: *sp++ = m->R[*pc++]; break;
+    case C_PC: *sp++ = m->PC; break;
+    case C_MEM:
+      a = sp[-1];
+      sp[-1] = (a >= 0 && a < STACK_SIZE) ? m->mem[a].data : 0;
+      break;
+    case C_NOT: sp[-1] = !sp[-1]; break;
+    case C_NEG: sp[-1] = -sp[-1]; break;
+    default:
+      //all remaining operators are binary
+      a = *--sp;
+      switch (pc[-1]) {
+      case C_OR: sp[-1] = sp[-1] || a; break;
+      case C_AND: sp[-1] = sp[-1] && a; break;
+      case C_EQ: sp[-1] = sp[-1] == a; break;
+      case C_NEQ: sp[-1] = sp[-1] != a; break;
+      case C_LT: sp[-1] = sp[-1] < a; break;
+      case C_LTE: sp[-1] = sp[-1] <= a; break;
+      case C_GT: sp[-1] = sp[-1] > a; break;
+      case C_GTE: sp[-1] = sp[-1] >= a; break;
+      case C_ADD: sp[-1] += a; break;
+      case C_SUB: sp[-1] -= a; break;
+      case C_MULT: sp[-1] *= a; break;
+      case C_DIV:
+        //x / -1 is -x, which wraps for INT_MIN instead of trapping
+        if (a == -1) sp[-1] = (int)(0u - (unsigned)sp[-1]);
+        else sp[-1] = a ? sp[-1] / a : 0;
+        break;
+      }
+    }
+  }
+
+  return sp[-1];
+}
@@ -19,12 +19,14 @@
 #endif
 
 #include "sim.h"
+#include "probes.h"
 #include <sys/shm.h>
 #include <sys/ipc.h>
 
-#define MAX_ARGS 5
+#define MAX_ARGS 16
 #define MAX_ARGLEN 30
 #define MAX_BREAKPOINTS 100
+#define MAX_SCRIPT_DEPTH 8
 
 static int ac;
 static char av[MAX_ARGS][MAX_ARGLEN];
@@ -34,14 +36,16 @@ int strpcmp(char *shortstring, char *longstring) {
 }
 
 
-int add_breakpoint(struct ami_machine *m, unsigned int addr) {
+int add_breakpoint(struct ami_machine *m, unsigned int addr, struct cond *cond) {
   static int bpnum = 1;
   struct breakpoint *b = malloc(sizeof(struct breakpoint));
   b->id = bpnum++;
   b->enabled = 1;
   b->addr = addr;
+  b->cond = cond;
   b->next = m->breakpoints;
   m->breakpoints = b;
+  mark_breakpoint_blocks(m);
   return b->id;
 }
 
@@ -54,7 +58,9 @@ void del_breakpoint(struct ami_machine *m, unsigned int id) {
   }
   if (b != NULL) {
     *pprev = b->next;
+    cond_free(b->cond);
     free(b);
+    mark_breakpoint_blocks(m);
     printf("breakpoint %d deleted\n", id);
   } else {
     printf("no such breakpoint %d\n", id);
@@ -66,7 +72,7 @@ int is_breakpoint(struct ami_machine *m, unsigned int addr) {
   while (b != NULL && b->addr != addr)
     b = b->next;
   if (!b) return 0;
-  if (b->enabled) return 1;
+  if (b->enabled) return !b->cond || cond_eval(m, b->cond);
   printf("skipping breakpoint at %d\n", addr);
   b->enabled = 1;
   return 0;
@@ -100,11 +106,40 @@ void dump_breakpoints(struct ami_machine *m) {
   struct breakpoint *b = m->breakpoints;
   if (b == NULL) printf("no breakpoints set\n");
   while (b != NULL) {
-    printf("breakpoint %d at address %d\n", b->id, b->addr);
+    if (b->cond)
+      printf("breakpoint %d at address %d if %s\n", b->id, b->addr, b->cond->text);
+    else
+      printf("breakpoint %d at address %d\n", b->id, b->addr);
     b = b->next;
   }
 }
 
+void dump_watchpoints(struct ami_machine *m) {
+  int i;
+  if (m->watch_count == 0) printf("no watchpoints set\n");
+  for (i = 0; i < STACK_SIZE; i++) {
+    if (m->watch[i] & WATCH_WRITE) printf("watchpoint at address %d\n", i);
+    if (m->watch[i] & WATCH_READ) printf("read watchpoint at address %d\n", i);
+  }
+}
+
+/*
+  Splits line into ac/av.  A line with no words leaves the previous
+  command in place so that it is repeated.
+ */
+static void tokenize(char *line) {
+  char *tok = strtok(line, " \t");
+  if (tok == NULL)
+    return; // do same command again
+
+  ac = 0;
+  while (tok != NULL && ac < MAX_ARGS) {
+    strncpy(av[ac], tok, MAX_ARGLEN-1);
+    av[ac++][MAX_ARGLEN-1] = '\0';
+    tok = strtok(NULL, " \t");
+  }
+}
+
 void readcmd(struct ami_machine *m) {
   static char *line = NULL;
   if (line) free(line);
@@ -124,7 +159,7 @@ void readcmd(struct ami_machine *m) {
     }
     buffer[buffered] = '\0';
 
-    line = (char *) malloc(buffered);
+    line = (char *) malloc(buffered + 1);
     strcpy(line, buffer);
 
     int i;
@@ -147,24 +182,14 @@ void readcmd(struct ami_machine *m) {
   }
 
   add_history(line);
-
-  char *tok = strtok(line, " ");
-  if (tok == NULL) {
-    free(line);
-    return; // do same command again
-  }
-
-  ac = 0;
-  while (tok != NULL && ac < MAX_ARGS) {
-    strncpy(av[ac], tok, MAX_ARGLEN-1);
-    av[ac++][MAX_ARGLEN-1] = '\0';
-    tok = strtok(NULL, " ");
-  }
+  tokenize(line);
 }
 
 void send_string_to_gui(struct ami_machine *m, char string[]) {
   char *s;
   int i, sleep_time;
+
+  PROBE1(gui_send_start, strlen(string));
   //copy string to shared memory
   s = m->shm + 1;
   for (i = 0; i < strlen(string); i++) {
@@ -179,6 +204,7 @@ void send_string_to_gui(struct ami_machine *m, char string[]) {
   while (*m->shm != '\0') {
     nanosleep(100000, &sleep_time);
   }
+  PROBE1(gui_send_done, strlen(string));
 }
 
 void update_gui(struct ami_machine *m) {
@@ -186,6 +212,7 @@ void update_gui(struct ami_machine *m) {
   char *s;
   char buffer[buffer_size];
 
+  PROBE1(gui_update_start, m->PC);
   s = m->shm;
   for (i = 0; i < 256; i++) {
     *s = '\0';
@@ -215,8 +242,8 @@ void update_gui(struct ami_machine *m) {
     } else {
       sprintf(buffer, "%s%s\n", buffer, data); 
     }
-    free(data);
   }
+  arena_reset(&m->scratch);
 
   //conditionally add console io to string to send
   //(with another delimiter)
@@ -253,19 +280,442 @@ void update_gui(struct ami_machine *m) {
   }
 
   *m->shm = '\0';
+  PROBE1(gui_update_done, m->PC);
+}
+
+/*
+  In a server session (m->escape is set) the server runs 'quit',
+  'continue' and 'step' itself, a slice at a time, so they only get
+  here from a script.  Running them, or 'explore', to completion
+  would hold up every other session.
+ */
+static int server_refuses(struct ami_machine *m, char *command) {
+  if (!m->escape)
+    return 0;
+  printf("'%s'%s is not available in a server session\n", command,
+         m->batch ? " in a script" : "");
+  return 1;
+}
+
+/*
+  Executes the command in ac/av.
+ */
+static void exec_command(struct ami_machine *m)
+{
+  if (!strpcmp(av[0], "quit") || !strpcmp(av[0], "exit")) {
+    if (server_refuses(m, "quit"))
+      return;
+    printf("exiting debugger\n");
+    exit(0);
+  } else if (!strpcmp(av[0], "continue")) {
+    if (!server_refuses(m, "continue"))
+      run(m, 0);
+  } else if (!strpcmp(av[0], "step")) {
+    int steps = (ac == 1 ? 1 : atoi(av[1]));
+    if (server_refuses(m, "step"))
+      ;
+    else if (steps <= 0)
+      printf("expected a positive integer, but got '%s' instead\n", av[1]);
+    else {
+      run(m, steps);
+    }
+  } else if (!strpcmp(av[0], "reset")) {
+    printf("Resetting program state\n");
+    reset_machine(m);
+  } else if (!strcmp(av[0], "reload")) {
+    reload_program(m);
+  } else if (!strcmp(av[0], "autoreload")) {
+    if (ac != 2 || (strcmp(av[1], "on") && strcmp(av[1], "off")))
+      printf("expected 'on' or 'off'\n");
+    else if (!set_autoreload(m, !strcmp(av[1], "on")))
+      printf("autoreload %s\n", av[1]);
+  } else if (!strcmp(av[0], "reverse-step") || !strcmp(av[0], "rs")) {
+    int steps = (ac == 1 ? 1 : atoi(av[1]));
+    if (steps <= 0)
+      printf("expected a positive integer, but got '%s' instead\n", av[1]);
+    else
+      reverse_step(m, steps);
+  } else if (!strcmp(av[0], "reverse-continue") || !strcmp(av[0], "rc")) {
+    reverse_continue(m);
+  } else if (!strpcmp(av[0], "breakpoint")) {
+    if (ac != 2 && (ac < 4 || strcmp(av[2], "if"))) {
+      printf("expected an address and optional 'if <condition>', but got %d arguments\n", ac-1);
+    } else {
+      unsigned int addr = atoi(av[1]);
+      struct cond *cond = NULL;
+      if (addr == 0) {
+        printf("expected an address, but got '%s' instead\n", av[1]);
+      } else if (ac > 2) {
+        char text[MAX_ARGS * MAX_ARGLEN];
+        int i;
+        strcpy(text, av[3]);
+        for (i = 4; i < ac; i++) {
+          strcat(text, " ");
+          strcat(text, av[i]);
+        }
+        cond = cond_compile(text);
+      }
+      if (addr != 0 && (ac == 2 || cond)) {
+        int id = add_breakpoint(m, addr, cond);
+        printf("set breakpoint %d at address %d\n", id, addr);
+      }
+    }
+  } else if (!strpcmp(av[0], "watch") || !strcmp(av[0], "rwatch") || !strcmp(av[0], "unwatch")) {
+    if (ac != 2) {
+      printf("expected an address, but got %d arguments\n", ac-1);
+    } else {
+      unsigned int addr = atoi(av[1]);
+      if (addr >= STACK_SIZE || (addr == 0 && strcmp(av[1], "0")))
+        printf("expected an address, but got '%s' instead\n", av[1]);
+      else if (av[0][0] == 'u')
+        set_watchpoint(m, addr, 0);
+      else if (av[0][0] == 'r')
+        set_watchpoint(m, addr, m->watch[addr] | WATCH_READ);
+      else
+        set_watchpoint(m, addr, m->watch[addr] | WATCH_WRITE);
+    }
+  } else if (!strpcmp(av[0], "delete")) {
+    if (ac != 2) {
+      printf("exepcted a breakpoint number, but got %d arguments\n", ac-1);
+    } else {
+      int id = atoi(av[1]);
+      if (id == 0)
+        printf("expected a breakpoint number, but got '%s' instead\n", av[1]);
+      else
+        del_breakpoint(m, id);
+    }
+  } else if (!strpcmp(av[0], "info")) {
+    if (ac == 1) {
+      printf("expected an argument, one of: breakpoints, stack, memory, or registers\n");
+    } else if (!strpcmp(av[1], "registers")) {
+      dump_registers(m);
+    } else if (!strpcmp(av[1], "stack")) {
+      int size = m->opt_printstack ? m->opt_printstack : 64;
+      if (ac > 2) size = atoi(av[2]);
+      if (size < 0) printf("expected a positive integer, but got '%s' instead\n", av[2]);
+      else dump_stack(m, size);
+    } else if (!strpcmp(av[1], "breakpoints")) {
+      dump_breakpoints(m);
+    } else if (!strpcmp(av[1], "watchpoints")) {
+      dump_watchpoints(m);
+    } else if (!strpcmp(av[1], "blocks")) {
+      dump_blocks(m);
+    } else if (!strpcmp(av[1], "memory")) {
+      dump_segments(m);
+    } else if (!strpcmp(av[1], "cache")) {
+      dump_cache(m);
+    } else if (!strpcmp(av[1], "predictor")) {
+      dump_bpred(m);
+    } else if (!strpcmp(av[1], "timing")) {
+      dump_timing(m);
+    } else if (!strpcmp(av[1], "limits")) {
+      dump_limits(m);
+    } else if (!strpcmp(av[1], "trace")) {
+      int count = (ac > 2 ? atoi(av[2]) : 20);
+      if (!m->trace) printf("tracing is off\n");
+      else if (count <= 0) printf("expected a positive integer, but got '%s' instead\n", av[2]);
+      else trace_print(m->trace, stdout, count);
+    } else {
+      printf("don't know any info about '%s'; try help\n", av[1]);
+    }
+  } else if (!strpcmp(av[0], "display") || !strpcmp(av[0], "undisplay")) {
+    if (ac == 1) {
+      printf("expected an argument, one of: stack, registers, or disassembly\n");
+    } else if (!strpcmp(av[1], "registers")) {
+      m->opt_dumpreg = (av[0][0] == 'd');
+    } else if (!strpcmp(av[1], "stack")) {
+      if (av[0][0] == 'd') {
+        int size = 64;
+        if (ac > 2) size = atoi(av[2]);
+        if (size <= 0) printf("expected a positive integer, but got '%s' instead\n", av[2]);
+        else m->opt_printstack = size;
+      } else {
+        m->opt_printstack = -1;
+      }
+    } else {
+      printf("don't know how to display '%s'; try help\n", av[1]);
+    }
+  } else if (!strpcmp(av[0], "trace")) {
+    if (ac == 1) {
+      printf("expected an argument, one of: on, off, or save\n");
+    } else if (!strcmp(av[1], "on")) {
+      int size = (ac > 2 ? atoi(av[2]) : TRACE_DEFAULT_SIZE);
+      if (size <= 0) {
+        printf("expected a positive integer, but got '%s' instead\n", av[2]);
+      } else {
+        trace_free(m->trace);
+        m->trace = trace_create(size);
+        select_engine(m);
+        if (m->trace) printf("tracing the last %lu instructions\n", m->trace->mask + 1);
+        else printf("out of memory\n");
+      }
+    } else if (!strcmp(av[1], "off")) {
+      trace_free(m->trace);
+      m->trace = NULL;
+      select_engine(m);
+    } else if (!strpcmp(av[1], "save")) {
+      if (ac != 3) printf("expected a file name, but got %d arguments\n", ac-2);
+      else if (!m->trace) printf("tracing is off\n");
+      else if (trace_save(m->trace, av[2]) != 0) perror("Cannot write trace");
+      else printf("trace saved to %s\n", av[2]);
+    } else {
+      printf("don't know how to trace '%s'; try help\n", av[1]);
+    }
+  } else if (!strcmp(av[0], "cache")) {
+    if (ac == 2 && !strcmp(av[1], "off")) {
+      cache_off(m);
+    } else if (ac == 2 && !strcmp(av[1], "clear")) {
+      if (m->cache) cache_clear(m->cache);
+    } else if (ac < 4 || ac > 6) {
+      printf("expected a size, line size and associativity, or 'off' or 'clear'\n");
+    } else {
+      int replace = CACHE_LRU, write_back = 1, i, ok = 1;
+      for (i = 4; i < ac; i++) {
+        if (!strcmp(av[i], "lru")) replace = CACHE_LRU;
+        else if (!strcmp(av[i], "fifo")) replace = CACHE_FIFO;
+        else if (!strcmp(av[i], "wb")) write_back = 1;
+        else if (!strcmp(av[i], "wt")) write_back = 0;
+        else {
+          printf("expected lru, fifo, wb or wt, but got '%s' instead\n", av[i]);
+          ok = 0;
+        }
+      }
+      if (ok && atoi(av[1]) > 0 && atoi(av[2]) > 0 && atoi(av[3]) > 0) {
+        if (!cache_add_level(m, atoi(av[1]), atoi(av[2]), atoi(av[3]), replace, write_back))
+          printf("added L%d cache\n", m->cache->levels);
+      } else if (ok) {
+        printf("expected positive integers for size, line size and associativity\n");
+      }
+    }
+  } else if (!strcmp(av[0], "timing")) {
+    if (ac == 1) {
+      printf("expected an argument, one of: on, off, or clear\n");
+    } else if (!strcmp(av[1], "on")) {
+      int forwarding = !(ac > 2 && !strcmp(av[2], "noforward"));
+      free(m->timing);
+      m->timing = timing_create(forwarding);
+      select_engine(m);
+      if (m->timing) printf("timing %s forwarding\n", forwarding ? "with" : "without");
+      else printf("out of memory\n");
+    } else if (!strcmp(av[1], "off")) {
+      free(m->timing);
+      m->timing = NULL;
+      select_engine(m);
+    } else if (!strcmp(av[1], "clear")) {
+      if (m->timing) timing_clear(m->timing);
+    } else {
+      printf("don't know how to time '%s'; try help\n", av[1]);
+    }
+  } else if (!strcmp(av[0], "predict")) {
+    if (ac == 1) {
+      printf("expected an argument, one of: static, 1bit, 2bit, gshare, off, or clear\n");
+    } else if (!strcmp(av[1], "off")) {
+      bpred_free(m->bpred);
+      m->bpred = NULL;
+      select_engine(m);
+    } else if (!strcmp(av[1], "clear")) {
+      if (m->bpred) bpred_clear(m->bpred);
+    } else if (bpred_kind(av[1]) < 0) {
+      printf("don't know the predictor '%s'; try help\n", av[1]);
+    } else {
+      int entries = BPRED_DEFAULT_ENTRIES, btb = 0, assoc = 1, i = 2;
+      if (i < ac && strcmp(av[i], "btb"))
+        entries = atoi(av[i++]);
+      if (i < ac && !strcmp(av[i], "btb")) {
+        btb = (i + 1 < ac ? atoi(av[i + 1]) : 0);
+        assoc = (i + 2 < ac ? atoi(av[i + 2]) : 1);
+      }
+      if (entries <= 0 || btb < 0 || assoc <= 0 || (i < ac && btb == 0)) {
+        printf("expected positive integers for table and BTB sizes\n");
+      } else {
+        bpred_free(m->bpred);
+        m->bpred = bpred_create(bpred_kind(av[1]), entries, btb, assoc);
+        select_engine(m);
+        if (m->bpred) printf("predicting conditional jumps with %s\n", av[1]);
+        else printf("out of memory\n");
+      }
+    }
+  } else if (!strcmp(av[0], "limit")) {
+    if (ac != 3) {
+      printf("expected 'steps <n>' or 'time <seconds>'\n");
+    } else if (!strcmp(av[1], "steps")) {
+      if (atol(av[2]) < 0) printf("expected a count, but got '%s' instead\n", av[2]);
+      else m->max_steps = atol(av[2]);
+    } else if (!strcmp(av[1], "time")) {
+      if (atof(av[2]) < 0) printf("expected a number of seconds, but got '%s' instead\n", av[2]);
+      else m->max_seconds = atof(av[2]);
+    } else {
+      printf("don't know how to limit '%s'; try help\n", av[1]);
+    }
+  } else if (!strcmp(av[0], "loops")) {
+    if (ac != 2 || (strcmp(av[1], "on") && strcmp(av[1], "off")))
+      printf("expected 'on' or 'off'\n");
+    else
+      set_loop_detection(m, !strcmp(av[1], "on"));
+  } else if (!strcmp(av[0], "explore")) {
+    int values[MAX_ARGS], count = 0, budget = EXPLORE_DEFAULT_BUDGET, i;
+    for (i = 1; i < ac; i++) {
+      if (!strcmp(av[i], "budget") && i + 1 < ac)
+        budget = atoi(av[++i]);
+      else
+        values[count++] = atoi(av[i]);
+    }
+    if (server_refuses(m, "explore")) ;
+    else if (count == 0) printf("expected input values to try\n");
+    else if (budget <= 0) printf("expected a positive budget\n");
+    else explore_inputs(m, values, count, budget);
+  } else if (!strcmp(av[0], "save")) {
+    if (ac != 2) printf("expected a file name, but got %d arguments\n", ac-1);
+    else if (snapshot_save(m, av[1]) < 0) perror(av[1]);
+    else printf("state saved to %s\n", av[1]);
+  } else if (!strcmp(av[0], "load")) {
+    int status = (ac == 2 ? snapshot_load(m, av[1]) : 1);
+    if (ac != 2) printf("expected a file name, but got %d arguments\n", ac-1);
+    else if (status < 0) perror(av[1]);
+    else if (status == 0) printf("state restored from %s\n", av[1]);
+  } else if (!strcmp(av[0], "source")) {
+    if (ac != 2)
+      printf("expected a file name, but got %d arguments\n", ac-1);
+    else
+      source_script(m, av[1]);
+  } else if (!strpcmp(av[0], "?") || !strpcmp(av[0], "help")) {
+    printf(
+        "quit               -- quit the debugger\n"
+        "continue           -- continue running the program until exit or breakpoint\n"
+        "step               -- execute one step of the program\n"
+        "step <n>           -- execute n steps of the program\n"
+        "reset	      -- reset the simulation state and restart execution of the program from the beginning\n"
+        "reload             -- reload the program file, keeping registers, data and breakpoints\n"
+        "autoreload on|off  -- reload the program file whenever it is saved\n"
+        "reverse-step <n>   -- undo the last n steps of the program (abbreviated 'rs')\n"
+        "reverse-continue   -- run backwards to the previous breakpoint (abbreviated 'rc')\n"
+        "break <addr>       -- set a breakpoint to occur after execution reaches <addr>\n"
+        "break <addr> if <condition>\n"
+        "                   -- as above, but only stop when <condition> holds, e.g.\n"
+        "                      'break 4 if r3 > 1000 and c[b + 2] /= 0'\n"
+        "delete <i>         -- delete the breakpoint <i>\n"
+        "watch <addr>       -- stop after an instruction writes memory address <addr>\n"
+        "rwatch <addr>      -- stop after an instruction reads memory address <addr>\n"
+        "unwatch <addr>     -- remove any watchpoints on <addr>\n"
+        "info <thing>       -- get info about <thing>, which can be 'breakpoints', 'watchpoints',\n"
+        "                      'blocks', 'cache', 'timing', 'predictor', 'limits', 'stack',\n"
+        "                      'registers', or 'trace'\n"
+        "display <thing>    -- periodically display <thing>, which can be 'stack', or 'registers'\n"
+        "                      'stack' takes an optional argument of how many words to display;\n"
+        "undisplay <thing>  -- don't periodically display <thing> any more\n"
+        "trace on [n]       -- record the last n executed instructions (default 65536)\n"
+        "trace off          -- stop recording instructions\n"
+        "trace save <file>  -- write the recorded instructions to <file> for tracedump\n"
+        "cache <size> <line> <assoc> [lru|fifo] [wb|wt]\n"
+        "                   -- add a cache level below the existing ones, sizes in words\n"
+        "cache clear        -- empty the caches and zero their statistics\n"
+        "cache off          -- remove the cache model\n"
+        "timing on [noforward]\n"
+        "                   -- estimate cycles on a 5-stage pipeline, with or without forwarding\n"
+        "timing clear       -- zero the cycle counts\n"
+        "timing off         -- stop estimating cycles\n"
+        "predict <kind> [n] [btb <n> [ways]]\n"
+        "                   -- predict conditional jumps with an n entry 'static', '1bit',\n"
+        "                      '2bit' or 'gshare' predictor, optionally with a BTB\n"
+        "predict clear      -- reset the predictor and its statistics\n"
+        "predict off        -- stop predicting\n"
+        "limit steps <n>    -- stop 'continue' and 'step' after n instructions, 0 for no limit\n"
+        "limit time <s>     -- stop 'continue' and 'step' after s seconds, 0 for no limit\n"
+        "loops on|off       -- stop when the program comes back to the same state at a jump\n"
+        "[ctrl-c]           -- stop the program while it runs\n"
+        "explore <v>... [budget <n>]\n"
+        "                   -- run to the next input instruction, then try each value <v> there\n"
+        "                      in a forked copy, for up to <n> instructions each\n"
+        "save <file>        -- save the registers, memory, PC and breakpoints to <file>\n"
+        "load <file>        -- restore the state saved in <file> by 'save'\n"
+        "source <file>      -- run the commands in <file>, refreshing displays only at the end\n"
+        "[enter]            -- repeat the last command\n"
+        "\n"
+        "Note: All commands can be abbreviated by their first letter or any prefix.\n"
+        "For example, 'i b' stands for 'info breakpoints,'\n"
+        "and 's 10' stands for 'step 10'.\n"
+        );
+  } else {
+    printf("unrecognized command '%s'\n", av[0]);
+  }
+}
+
+/*
+  Runs the debugger commands in filename as one batch.  Display
+  hooks and GUI refreshes are held back until the outermost batch
+  ends and control returns to the command prompt.
+ */
+void source_script(struct ami_machine *m, char *filename)
+{
+  int saved_ac = ac;
+  char saved_av[MAX_ARGS][MAX_ARGLEN];
+  char *line = NULL;
+  size_t capacity = 0;
+  ssize_t len;
+
+  if (m->batch >= MAX_SCRIPT_DEPTH) {
+    printf("scripts nested too deeply, not running '%s'\n", filename);
+    return;
+  }
+
+  FILE *in = fopen(filename, "r");
+  if (!in) {
+    perror(filename);
+    return;
+  }
+
+  memcpy(saved_av, av, sizeof(av));
+  m->batch++;
+
+  while ((len = getline(&line, &capacity, in)) >= 0) {
+    if (len > 0 && line[len-1] == '\n')
+      line[len-1] = '\0';
+    if (line[strspn(line, " \t")] == '\0' || line[strspn(line, " \t")] == '#')
+      continue;
+    ac = 0;
+    tokenize(line);
+    if (ac > 0)
+      exec_command(m);
+  }
+
+  m->batch--;
+  memcpy(av, saved_av, sizeof(av));
+  ac = saved_ac;
+
+  free(line);
+  fclose(in);
+}
+
+/*
+  Runs one command line, as typed at the prompt
+ */
+void debug_command(struct ami_machine *m, char *line)
+{
+  char copy[MAX_ARGS * MAX_ARGLEN];
+
+  strncpy(copy, line, sizeof(copy) - 1);
+  copy[sizeof(copy) - 1] = '\0';
+  ac = 0;
+  tokenize(copy);
+  if (ac > 0)
+    exec_command(m);
 }
 
 void interactive_debug(struct ami_machine *m)
 {
+  catch_interrupts(m);
   rl_initialize();
   rl_bind_key('\t', rl_insert);
 
-  int err;
+  printf("Welcome to the AMI simulator built-in debugger. Type 'help' for a listing of commands.");
+  printf("\n");
+
+  if (m->script) {
+    source_script(m, m->script);
+  }
   if (m->opt_graphical) {
     update_gui(m);
   }
-  printf("Welcome to the AMI simulator built-in debugger. Type 'help' for a listing of commands.");
-  printf("\n");
 
   for (;;) {
     
@@ -276,110 +726,12 @@ void interactive_debug(struct ami_machine *m)
 	dump_stack(m, m->opt_printstack);
       } 
 
-    err = 0;
-
     readcmd(m);
+    if (m->autoreload_fd)
+      check_autoreload(m);
     if (ac == 0)
       continue;
-    if (!strpcmp(av[0], "quit") || !strpcmp(av[0], "exit")) {
-      printf("exiting debugger\n");
-      exit(0);
-    } else if (!strpcmp(av[0], "continue")) {
-      err = run(m, 0);
-    } else if (!strpcmp(av[0], "step")) {
-      int steps = (ac == 1 ? 1 : atoi(av[1]));
-      if (steps <= 0)
-	printf("expected a positive integer, but got '%s' instead\n", av[1]);
-      else {
-	err = run(m, steps);
-      }
-    } else if (!strpcmp(av[0], "reset")) {
-      printf("Resetting program state\n");
-      unskip_breakpoints(m);
-      memset(m->R, 0, sizeof(m->R));
-      m->PC = m->nPC = 0;
-      m->halted = 0;
-      free_segments(m);
-      allocate_stack(m);
-      
-    } else if (!strpcmp(av[0], "breakpoint")) {
-      if (ac != 2) {
-	printf("expected an address, but got %d arguments\n", ac-1);
-      } else {
-	unsigned int addr = atoi(av[1]);
-	if (addr == 0)
-	  printf("expected an address, but got '%s' instead\n", av[1]);
-	else {
-	  int id = add_breakpoint(m, addr);
-	  printf("set breakpoint %d at address %d\n", id, addr);
-	}
-      }
-    } else if (!strpcmp(av[0], "delete")) {
-      if (ac != 2) {
-	printf("exepcted a breakpoint number, but got %d arguments\n", ac-1);
-      } else {
-	int id = atoi(av[1]);
-	if (id == 0)
-	  printf("expected a breakpoint number, but got '%s' instead\n", av[1]);
-	else
-	  del_breakpoint(m, id);
-      }
-    } else if (!strpcmp(av[0], "info")) {
-      if (ac == 1) {
-	printf("expected an argument, one of: breakpoints, stack, memory, or registers\n");
-      } else if (!strpcmp(av[1], "registers")) {
-	dump_registers(m);
-      } else if (!strpcmp(av[1], "stack")) {
-	int size = m->opt_printstack ? m->opt_printstack : 64;
-	if (ac > 2) size = atoi(av[2]);
-	if (size < 0) printf("expected a positive integer, but got '%s' instead\n", av[2]);
-	else dump_stack(m, size);
-      } else if (!strpcmp(av[1], "breakpoints")) {
-	dump_breakpoints(m);
-      } else if (!strpcmp(av[1], "memory")) {
-	dump_segments(m);
-      } else {
-	printf("don't know any info about '%s'; try help\n", av[1]);
-      }
-    } else if (!strpcmp(av[0], "display") || !strpcmp(av[0], "undisplay")) {
-      if (ac == 1) {
-	printf("expected an argument, one of: stack, registers, or disassembly\n");
-      } else if (!strpcmp(av[1], "registers")) {
-	m->opt_dumpreg = (av[0][0] == 'd');
-      } else if (!strpcmp(av[1], "stack")) {
-	if (av[0][0] == 'd') {
-	  int size = 64;
-	  if (ac > 2) size = atoi(av[2]);
-	  if (size <= 0) printf("expected a positive integer, but got '%s' instead\n", av[2]);
-	  else m->opt_printstack = size;
-	} else {
-	  m->opt_printstack = -1;
-	}
-      } else {
-	printf("don't know how to display '%s'; try help\n", av[1]);
-      }
-    } else if (!strpcmp(av[0], "?") || !strpcmp(av[0], "help")) {
-      printf(
-	  "quit               -- quit the debugger\n"
-	  "continue           -- continue running the program until exit or breakpoint\n"
-	  "step               -- execute one step of the program\n"
-	  "step <n>           -- execute n steps of the program\n"
-	  "reset	      -- reset the simulation state and restart execution of the program from the beginning\n"
-	  "break <addr>       -- set a breakpoint to occur after execution reaches <addr>\n"
-	  "delete <i>         -- delete the breakpoint <i>\n"
-	  "info <thing>       -- get info about <thing>, which can be 'breakpoints', 'stack', or 'registers'\n"
-	  "display <thing>    -- periodically display <thing>, which can be 'stack', or 'registers'\n"
-	  "                      'stack' takes an optional argument of how many words to display;\n"
-	  "undisplay <thing>  -- don't periodically display <thing> any more\n"
-	  "[enter]            -- repeat the last command\n"
-	  "\n"
-	  "Note: All commands can be abbreviated by their first letter or any prefix.\n"
-	  "For example, 'i b' stands for 'info breakpoints,'\n"
-	  "and 's 10' stands for 'step 10'.\n"
-	  );
-    } else {
-      printf("unrecognized command '%s'\n", av[0]);
-    }
+    exec_command(m);
     if (m->opt_graphical) {
       update_gui(m);
     }
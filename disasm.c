@@ -4,11 +4,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
 #include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "sim.h"
 
+#define DECODE_CHUNK 16384//fewest lines worth starting a thread for
+#define MAX_DECODE_THREADS 64
+
 void dump_registers(struct ami_machine *m) {
   printf("Registers:\n");
   printf("pc: %i\n", m->PC);
@@ -26,394 +31,364 @@ void dump_disassembly(FILE *out, unsigned int pc, unsigned int inst)
   printf("dumping disassembly\n");
 }
 
-struct stack_entry disasm_instr(struct ami_machine *m, char *instr) {
-  struct stack_entry ret;
-  char *stop_words[12];
-
-  //copy the instruction to preserve
-  //for printing later
-  ret.instruction = (char*) malloc(strlen(instr) + 1);
-  strcpy(ret.instruction, instr);
-  char *token = strtok(instr, " ");
-  ret.argc = 0;
-
+/*
+  The decoder.  A lexer turns a line into typed tokens in one pass,
+  looking words and operators up in the perfect hash table generated
+  into keywords.h.  Each token contributes one character to the
+  line's shape (every operand, including a whole 'contents' address,
+  is an 'a'), and the shape is looked up in syntax_table to find the
+  instruction.  No part of the decoder modifies the line or keeps
+  state between calls.
+ */
+
+enum {
+  K_END, K_NUMBER, K_REGISTER, K_UNKNOWN, K_TOO_BIG,
+  K_HALT, K_WRITE, K_READ, K_PC, K_CONTENTS, K_IF, K_NOT,
+  K_ASSIGN, K_MINUS, K_BINOP
+};
+
+struct keyword {
+  const char *name;
+  int len, kind, op;
+};
+
+#include "keywords.h"
+
+struct token {
+  int kind;
+  int value;//number, register, or opcode of an operator
+};
+
+/*
+  Opcodes in syntax_table that are resolved from the operands
+ */
+enum {
+  OP_COPY = -1,//IDM, MOVE, LOAD or STORE
+  OP_NEGATE = -2,//IDM of a negative number, or NEG
+  OP_KEYWORD = -3//READB/READI or a binary operator, from the token
+};
+
+#define SHAPE(s) s, sizeof(s) - 1
+
+static const struct syntax {
+  const char *shape;
+  int len, op;
+} syntax_table[] = {
+  { SHAPE("h"), HALT },
+  { SHAPE("wa"), WRITE },
+  { SHAPE("Ra"), OP_KEYWORD },
+  { SHAPE("P:a"), JUMP },
+  { SHAPE("P:a?a"), JUMPIF },
+  { SHAPE("P:a?!a"), JUMPNIF },
+  { SHAPE("a:a"), OP_COPY },
+  { SHAPE("a:-a"), OP_NEGATE },
+  { SHAPE("a:!a"), NOT },
+  { SHAPE("a:aoa"), OP_KEYWORD },
+  { SHAPE("a:a-a"), SUB },
+};
+
+#define MAX_SHAPE 8
+
+static const struct keyword *find_keyword(const char *s, int len) {
+  const struct keyword *k = &keyword_table[KEYWORD_HASH(s, len)];
+  if (k->len == len && !memcmp(k->name, s, len))
+    return k;
+  return NULL;
+}
 
-  init_stop_words(stop_words);
-  
-  //strip line number from instruction
-  if (isdigit(token[0])) {
-    token = strtok(NULL, " ");
+/*
+  Character classes for the lexer, so that it does not go through
+  the locale for every character
+ */
+enum { C_SPACE = 1, C_DIGIT = 2, C_WORD = 4 };
+
+#define DIGIT_RANGE(lo, hi) [lo ... hi] = C_DIGIT | C_WORD
+#define WORD_RANGE(lo, hi) [lo ... hi] = C_WORD
+
+static const unsigned char char_class[256] = {
+  [' '] = C_SPACE, ['\t'] = C_SPACE, [','] = C_SPACE, ['\r'] = C_SPACE,
+  DIGIT_RANGE('0', '9'), WORD_RANGE('a', 'z'), WORD_RANGE('A', 'Z'), ['_'] = C_WORD
+};
+
+#define is_space(c) (char_class[(unsigned char)(c)] & C_SPACE)
+#define is_digit(c) (char_class[(unsigned char)(c)] & C_DIGIT)
+#define is_word_char(c) (char_class[(unsigned char)(c)] & C_WORD)
+
+/*
+  Reads the token starting at s into t and returns the text after
+  it.  Commas only separate address components and are skipped; the
+  decoder looks for one right after a token, which makes 'b, 4' an
+  address just like 'contents b, 4'.
+ */
+static const char *lex(const char *s, struct token *t) {
+  const char *start;
+  const struct keyword *k;
+
+  while (is_space(*s))
+    s++;
+  start = s;
+
+  if (*s == '\0') {
+    t->kind = K_END;
+    return s;
   }
 
-  switch(token[0]) {
-  case 'h':
-    if (!strcmp(token, "halt")) 
-      ret.op = HALT;
-    break;
-  case 'w':
-    if (!strcmp(token, "write")) {
-      ret.op = WRITE;
-      read_argument(&ret, strtok(NULL, " "), stop_words, 12);
+  if (is_digit(*s)) {
+    t->kind = K_NUMBER;
+    t->value = 0;
+    for (; is_digit(*s); s++) {
+      if (t->value > (INT_MAX - (*s - '0')) / 10)
+        t->kind = K_TOO_BIG;
+      else
+        t->value = t->value * 10 + (*s - '0');
     }
-    break;
-  case 'r':
-    if (!strcmp(token, "read_boolean")) {
-      ret.op = READB;
-      read_argument(&ret, strtok(NULL, " "), stop_words, 12);
-    } else if (!strcmp(token, "read_integer")) {
-      ret.op = READI;
-      read_argument(&ret, strtok(NULL, " "), stop_words, 12);
+    return s;
+  }
+
+  if (is_word_char(*s)) {
+    while (is_word_char(*s))
+      s++;
+
+    if (s - start == 1 && *start == 'b') {
+      t->kind = K_REGISTER;
+      t->value = 0;
+    } else if (*start == 'r' && s - start > 1 && is_digit(start[1])) {
+      const char *d;
+      t->kind = K_REGISTER;
+      t->value = 0;
+      for (d = start + 1; d < s && is_digit(*d) && t->value < MAX_REGISTERS; d++)
+        t->value = t->value * 10 + (*d - '0');
+      if (d < s || t->value >= MAX_REGISTERS)
+        t->kind = K_UNKNOWN;
+    } else if ((k = find_keyword(start, s - start))) {
+      t->kind = k->kind;
+      t->value = k->op;
     } else {
-      ret.arguments[0].reg = atoi(token + 1);
-      ret.arguments[0].type = REGISTER;
-      ret.argc = 1;
-
-      //check if this is setting aside a new register
-      //and increase register count
-      if (ret.arguments[0].reg > m->reg_count) {
-	m->reg_count = ret.arguments[0].reg + 1;
-      }
+      t->kind = K_UNKNOWN;
+    }
+    return s;
+  }
 
-      //skip ':='
-      token = strtok(NULL, " ");
-
-      token = strtok(NULL, " ");
-      
-      if (isdigit(token[0])) {
-	ret.op = IDM;
-	read_argument(&ret, token, stop_words, 12);
-      } else if (token[0] == '-') {
-	if (strlen(token) == 1) {
-	  token = strtok(NULL, " ");
-	
-	  if (isdigit(token[0])) {
-	    ret.op = IDM;
-	    ret.arguments[1].type = NUMBER;
-	    ret.arguments[1].number = -1 * atoi(token);
-	    
-	  } else {
-	    ret.op = NEG;
-	    read_argument(&ret, token, stop_words, 12);
-	  }
-	} else {
-	  if (isdigit(token[1])) {
-	    ret.op = IDM;
-	    ret.arguments[1].type = NUMBER;
-	    ret.arguments[1].number = atoi(token);
-	    
-	  } else {
-	    ret.op = NEG;
-	    read_argument(&ret, token + 1, stop_words, 12);
-	  }
-	}
-      } else {
-	//Argument arithmetic
-	
-	if (!strcmp(token, "not")) {
-	  ret.op = NOT;
-	  read_argument(&ret, strtok(NULL, " "), stop_words, 12);
-	} else {
-	  /*
-	   * Either ALU arithmetic, Argument arithmetic,
-	   * MOVE, or LOAD.
-	   * Will need to check after parsing that ALU ops
-	   * only used with registers as arguments.
-	   */
-	  char argType = token[0];
-	  //	  if (argType == 'c') {
-	  token = read_argument(&ret, token, stop_words, 12);
-	    //	  } 
-	  if (argType == 'r' || argType == 'b') {
-	    token = strtok(NULL, " ");
-	  }
-	  
-
-	  if (token == NULL) {
-	    if (argType == 'c') {
-	      ret.op = LOAD;
-	    } else if (argType == 'r' || argType == 'b') {
-	      ret.op = MOVE;
-	    }
-	  } else {
-	    if (!strcmp(token, "=")) {
-	      ret.op = EQ;
-	    } else if (!strcmp(token, "/=")) {
-	      ret.op = NEQ;
-	    } else if (!strcmp(token, "<")) {
-	      ret.op = LT;
-	    } else if (!strcmp(token, "<=")) {
-	      ret.op = LTE;
-	    } else if (!strcmp(token, "and")) {
-	      ret.op = AND;
-	    } else if (!strcmp(token, "or")) {
-	      ret.op = OR;
-	    } else if (!strcmp(token, "+")) {
-	      ret.op = ADD;
-	    } else if (!strcmp(token, "-")) {
-	      ret.op = SUB;
-	    } else if (!strcmp(token, "*")) {
-	      ret.op = MULT;
-	    } else if (!strcmp(token, "/")) {
-	      ret.op = DIV;
-	    } 
-	    read_argument(&ret, strtok(NULL, " "), stop_words, 12);
-	  }
-	}
+  //operators are one or two characters; prefer the longer match
+  if (s[1] && (k = find_keyword(s, 2))) {
+    t->kind = k->kind;
+    t->value = k->op;
+    return s + 2;
+  }
+  if ((k = find_keyword(s, 1))) {
+    t->kind = k->kind;
+    t->value = k->op;
+    return s + 1;
+  }
+
+  t->kind = K_UNKNOWN;
+  return s + 1;
+}
+
+/*
+  Decodes the instruction in text into ret, without copying text.
+  *reg_count is raised past every register named.  Returns 0, or -1
+  with ret->op set to ILLEGAL and ret->error describing the problem.
+  Safe to call from several threads with different reg_counts.
+ */
+int decode_instr(const char *text, struct stack_entry *ret, int *reg_count) {
+  char shape[MAX_SHAPE];
+  int len = 0, keyword_op = 0, i;
+  struct token t;
+  const char *s = text;
+
+  ret->argc = 0;
+  ret->data = 0;
+  ret->error = NULL;
+
+  //strip line number from instruction
+  s = lex(s, &t);
+  if (t.kind == K_NUMBER) {
+    const char *rest = lex(s, &t);
+    if (t.kind != K_END)
+      s = rest;
+  }
+
+  while (t.kind != K_END) {
+    char c;
+
+    switch (t.kind) {
+    case K_NUMBER:
+    case K_REGISTER:
+    case K_CONTENTS: {
+      struct argument *arg = &ret->arguments[ret->argc];
+      if (ret->argc == 3) {
+        ret->error = "too many arguments in instruction";
+        goto illegal;
       }
-      break;
-    }
-    break;
-  case 'p':
-    if (!strcmp(token, "pc")) {
-      //skip ':=' 
-      strtok(NULL, " ");
-      token = strtok(NULL, " ");
-      
-      token = read_argument(&ret, token, stop_words, 12);
-      token = strtok(NULL, " ");
-
-      if (token == NULL) {
-	ret.op = JUMP;
-	ret.argc = 1;
+      ret->argc++;
+      c = 'a';
+      if (t.kind == K_NUMBER && *s != ',') {
+        arg->type = NUMBER;
+        arg->number = t.value;
+      } else if (t.kind == K_REGISTER && *s != ',') {
+        arg->type = REGISTER;
+        arg->reg = t.value;
+        if (t.value >= *reg_count)
+          *reg_count = t.value + 1;
       } else {
-	token = strtok(NULL, " ");
-	if (!strcmp(token, "not")) {
-	  ret.op = JUMPNIF;
-	  token = strtok(NULL, " ");
-	} else {
-	  ret.op = JUMPIF;
-	}
-	
-	token = read_argument(&ret, token, stop_words, 12);
-
-	ret.argc = 2;
+        //an address sums the registers and displacements that follow
+        //'contents', or that start with one followed by a comma
+        arg->type = ADDRESS;
+        arg->addc = 0;
+        if (t.kind != K_CONTENTS) {
+          arg->add[0].type = (t.kind == K_REGISTER) ? REG : DISP;
+          arg->add[0].value = t.value;
+          arg->addc = 1;
+        }
+        for (s = lex(s, &t); t.kind == K_NUMBER || t.kind == K_REGISTER; s = lex(s, &t)) {
+          if (arg->addc == 3) {
+            ret->error = "too many parts in address";
+            goto illegal;
+          }
+          arg->add[arg->addc].type = (t.kind == K_REGISTER) ? REG : DISP;
+          arg->add[arg->addc].value = t.value;
+          arg->addc++;
+        }
+        if (arg->addc == 0) {
+          ret->error = "expected an address after 'contents'";
+          goto illegal;
+        }
+        if (len == MAX_SHAPE) {
+          ret->error = "instruction is too long";
+          goto illegal;
+        }
+        shape[len++] = c;
+        continue;//t already holds the token after the address
       }
       break;
     }
-  case 'b':
-    ret.arguments[0].type = REGISTER;
-    ret.arguments[0].reg = 0;
-    ret.argc = 1;
-    //skip ':='
-    token = strtok(NULL, " ");
-
-    token = strtok(NULL, " ");
-
-    if (token[0] == 'c') {
-      ret.op = LOAD;
-    } else if (token[0] == 'r') {
-      ret.op = MOVE;
-    } else if (isdigit(token[0])) {
-      ret.op = IDM;
-    } else if (token[0] == '-') {
-      ret.op = IDM;
+    case K_HALT: c = 'h'; break;
+    case K_WRITE: c = 'w'; break;
+    case K_READ: c = 'R'; keyword_op = t.value; break;
+    case K_PC: c = 'P'; break;
+    case K_ASSIGN: c = ':'; break;
+    case K_IF: c = '?'; break;
+    case K_NOT: c = '!'; break;
+    case K_MINUS: c = '-'; break;
+    case K_BINOP: c = 'o'; keyword_op = t.value; break;
+    case K_TOO_BIG:
+      ret->error = "number is too large";
+      goto illegal;
+    default:
+      ret->error = "unrecognized word";
+      goto illegal;
     }
 
-    read_argument(&ret, token, stop_words, 12);
-
-    break;
-  case 'c':
-    //read in the address
-    read_argument(&ret, token, stop_words, 12);
-
-    token = strtok(NULL, " ");
-
-    if (isdigit(token[0])) {
-      ret.op = IDM;
-      read_argument(&ret, token, stop_words, 12);
-    } else if (token[0] == '-') {
-      if (strlen(token) == 1) {
-	token = strtok(NULL, " ");
-	
-	if (isdigit(token[0])) {
-	  ret.op = IDM;
-	  ret.arguments[1].type = NUMBER;
-	  ret.arguments[1].number = -1 * atoi(token);
-	  
-	} else {
-	  ret.op = NEG;
-	  read_argument(&ret, token, stop_words, 12);
-	}
-      } else {
-	if (isdigit(token[1])) {
-	  ret.op = IDM;
-	  ret.arguments[1].type = NUMBER;
-	  ret.arguments[1].number = atoi(token);
-	  
-	} else {
-	  ret.op = NEG;
-	  read_argument(&ret, token + 1, stop_words, 12);
-	}
-      }
-    } else {
-      //Argument arithmetic
-	
-      if (!strcmp(token, "not")) {
-	ret.op = NOT;
-	read_argument(&ret, strtok(NULL, " "), stop_words, 12);
-      } else {
-	/*
-	 * Either ALU arithmetic, Argument arithmetic,
-	 * MOVE, or LOAD.
-	 * Will need to check after parsing that ALU ops
-	 * only used with registers as arguments.
-	 */
-	char argType = token[0];
-
-	token = read_argument(&ret, token, stop_words, 12);
-
-	if (argType == 'r' || argType == 'b') {
-	  token = strtok(NULL, " ");
-	}
-	  
-
-	if (token == NULL) {
-	  if (argType == 'c') {
-	    ret.op = MOVE;
-	  } else if (argType == 'r' || argType == 'b') {
-	    ret.op = STORE;
-	  }
-	} else {
-	  if (!strcmp(token, "and")) {
-	    ret.op = AND;
-	  } else if (!strcmp(token, "or")) {
-	    ret.op = OR;
-	  } else if (!strcmp(token, "+")) {
-	    ret.op = ADD;
-	  } else if (!strcmp(token, "-")) {
-	    ret.op = SUB;
-	  } else if (!strcmp(token, "*")) {
-	    ret.op = MULT;
-	  } else if (!strcmp(token, "/")) {
-	    ret.op = DIV;
-	  } 
-	  read_argument(&ret, strtok(NULL, " "), stop_words, 12);
-	}
-      }
+    if (len == MAX_SHAPE) {
+      ret->error = "instruction is too long";
+      goto illegal;
     }
+    shape[len++] = c;
+    s = lex(s, &t);
+  }
 
-    /* token = strtok(NULL, " ");
+  for (i = 0; i < sizeof(syntax_table) / sizeof(syntax_table[0]); i++) {
+    if (syntax_table[i].len == len && !memcmp(syntax_table[i].shape, shape, len))
+      break;
+  }
+  if (i == sizeof(syntax_table) / sizeof(syntax_table[0])) {
+    ret->error = "unrecognized instruction";
+    goto illegal;
+  }
 
-    if (token[0] == 'c') {
-      ret.op = MOVE;
-    } else if (token[0] == 'r') {
-      ret.op = STORE;
-    } else if (isdigit(token[0])) {
-      ret.op = IDM;
-    } else if (token[0] == '-') {
-      ret.op = IDM
+  ret->op = syntax_table[i].op;
+  if (ret->op == OP_KEYWORD) {
+    ret->op = keyword_op;
+  } else if (ret->op == OP_NEGATE) {
+    if (ret->arguments[1].type == NUMBER) {
+      ret->op = IDM;
+      ret->arguments[1].number = -ret->arguments[1].number;
+    } else {
+      ret->op = NEG;
     }
-    read_argument(&ret, token, stop_words, 12);*/
-    break; 
-  default:
-    printf("Unrecognized command: %s\n", token);
-    exit(1);
+  } else if (ret->op == OP_COPY) {
+    int dst = ret->arguments[0].type, src = ret->arguments[1].type;
+    if (src == NUMBER)
+      ret->op = IDM;
+    else if (dst == REGISTER && src == ADDRESS)
+      ret->op = LOAD;
+    else if (dst == ADDRESS && src == REGISTER)
+      ret->op = STORE;
+    else
+      ret->op = MOVE;
   }
 
   //regardless of which case it is, they are all instructions
-  ret.data_type = INSTRUCTION;
+  ret->data_type = INSTRUCTION;
+  return 0;
 
-  return ret;
+ illegal:
+  ret->op = ILLEGAL;
+  ret->data_type = INSTRUCTION;
+  return -1;
 }
 
-int contains(char *needle, char *haystack[], int size) {
-  int i;
-  for (i = 0; i < size; i++) {
-    if (!strcmp(haystack[i], needle)) {
-      return TRUE;
-    }
-  }
+struct decode_job {
+  struct ami_machine *m;
+  unsigned int start, end;
+  int reg_count;
+};
 
-  return FALSE;
-}
+static void *decode_range(void *arg) {
+  struct decode_job *job = arg;
+  unsigned int i;
 
-char* read_argument(struct stack_entry *ret, char *token, char * stop_words[], int words) {
-  if (ret->argc >= 3) {
-    //raise("Too many arguments in instruction\n");
-    printf("Too many arguments in instruction\n");
+  for (i = job->start; i < job->end; i++) {
+    struct stack_entry *e = &job->m->mem[i];
+    decode_instr(e->instruction, e, &job->reg_count);
   }
-
-  //get the index of this argument
-  int argNum = ret->argc;
-  ret->argc++;
-  
-  //this function assumes that it is being called from
-  //inside disasm_instruction, and that strtok has been called
-  //on the instruction string
-
-  if (token[0] == 'c' || token[strlen(token) - 1] == ',') {
-    ret->arguments[argNum].type = ADDRESS;
-    int addc= 0;
-
-    //loop until end of line, or the next token is arrived at
-    while (token != NULL && !contains(token, stop_words, words)) {
-      if (token[0] == 'r' || token[0] == 'b') {
-	//this address is a register
-	ret->arguments[argNum].add[addc].type = REG;
-	ret->arguments[argNum].add[addc].value = atoi(token + 1);
-	addc += 1;
-      } else if (isdigit(token[0])) {
-	//this address is a displacement
-	ret->arguments[argNum].add[addc].type = DISP;
-	ret->arguments[argNum].add[addc].value = atoi(token);
-	addc += 1;
-      }
-      token = strtok(NULL, " ");
-    }
-    ret->arguments[argNum].addc = addc;
-   } else if (token[0] == 'r') {
-    //if this argument is a register, read a number into it
-    ret->arguments[argNum].type = REGISTER;
-    ret->arguments[argNum].reg = atoi(token + 1);
-  } else if (token[0] == 'b') {
-    ret->arguments[argNum].type = REGISTER;
-    ret->arguments[argNum].reg = 0;
-  } else if (isdigit(token[0])) {
-    ret->arguments[argNum].type = NUMBER;
-    ret->arguments[argNum].number = atoi(token);
-  } else {
-    //raise("Inappropriate argument: %s\n", token);
-    printf("Inappropriate argument: %s\n", token);
-    token = strtok(NULL, " ");
-  }
-
-  return token;
+  return NULL;
 }
 
-void init_stop_words(char *stop_words[]) {
-  stop_words[0] = (char *) malloc(sizeof("if") + 1);
-  strcpy(stop_words[0], "if");
-
-  stop_words[1] = (char *) malloc(sizeof("and") + 1);
-  strcpy(stop_words[1], "and");
-
-  stop_words[2] = (char *) malloc(sizeof("or") + 1);
-  strcpy(stop_words[2], "or");
-
-  stop_words[3] = (char *) malloc(sizeof("+") + 1);
-  strcpy(stop_words[3], "+");
-
-  stop_words[4] = (char *) malloc(sizeof("-") + 1);
-  strcpy(stop_words[4], "-");
-
-  stop_words[5] = (char *) malloc(sizeof("*") + 1);
-  strcpy(stop_words[5], "*");
-
-  stop_words[6] = (char *) malloc(sizeof("/") + 1);
-  strcpy(stop_words[6], "/");
-
-  stop_words[7] = (char *) malloc(sizeof(":=") + 1);
-  strcpy(stop_words[7], ":=");
+/*
+  Decodes every slot of the program, whose instruction fields point at
+  the lines of the source text in the program arena.  Large programs
+  are split into contiguous chunks decoded by one thread per
+  core.  Each thread keeps its own register count, and the counts are
+  merged once all have finished.  Bad instructions are left ILLEGAL in
+  their own slots, so verify_program() reports them in program order
+  no matter which thread decoded them.
+ */
+void decode_program(struct ami_machine *m) {
+  struct decode_job jobs[MAX_DECODE_THREADS];
+  pthread_t threads[MAX_DECODE_THREADS];
+  int started[MAX_DECODE_THREADS];
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int n = m->slots_used / DECODE_CHUNK, i;
+
+  if (n > cores)
+    n = cores;
+  if (n > MAX_DECODE_THREADS)
+    n = MAX_DECODE_THREADS;
+  if (n < 1)
+    n = 1;
+
+  for (i = 0; i < n; i++) {
+    jobs[i].m = m;
+    jobs[i].start = (unsigned long)m->slots_used * i / n;
+    jobs[i].end = (unsigned long)m->slots_used * (i + 1) / n;
+    jobs[i].reg_count = m->reg_count;
+  }
 
-  stop_words[8] = (char *) malloc(sizeof("=") + 1);
-  strcpy(stop_words[8], "=");
+  //this thread decodes the first chunk, and any chunk whose thread
+  //could not be started
+  for (i = 1; i < n; i++) {
+    started[i] = !pthread_create(&threads[i], NULL, decode_range, &jobs[i]);
+    if (!started[i])
+      decode_range(&jobs[i]);
+  }
+  decode_range(&jobs[0]);
 
-  stop_words[9] = (char *) malloc(sizeof("/=") + 1);
-  strcpy(stop_words[9], "/=");
-  
-  stop_words[10] = (char *) malloc(sizeof("<") + 1);
-  strcpy(stop_words[10], "<");
-  
-  stop_words[11] = (char *) malloc(sizeof("<=") + 1);
-  strcpy(stop_words[11], "<=");
+  for (i = 0; i < n; i++) {
+    if (i > 0 && started[i])
+      pthread_join(threads[i], NULL);
+    if (jobs[i].reg_count > m->reg_count)
+      m->reg_count = jobs[i].reg_count;
+  }
 }
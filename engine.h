@@ -0,0 +1,499 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  The instruction interpreter, instantiated by run.c once per engine
+  variant.  Before each inclusion define:
+
+    ENGINE_NAME     name of the generated run function
+    ENGINE_HOOKS    1 to route memory accesses through the watchpoint
+                    checks and cache model, report conditional jumps
+                    to the branch predictor and record trace records
+                    and timing and look for loops, 0 for the plain
+                    engine that pays nothing for any of them
+    ENGINE_CHECKED  1 to check each instruction with
+                    instruction_error() before executing it, 0 for
+                    programs that passed verify_program() at load
+
+  Either way the engine checks what depends on run-time values:
+  computed jump targets, division by zero, and (in mem.c) computed
+  addresses and writes over instructions.
+ */
+
+#if ENGINE_HOOKS
+#define MEM_WRITE(m, addr, value) mem_write_watched(m, addr, value)
+#define MEM_READ(m, addr) mem_read_watched(m, addr)
+#define ARG_VALUE(m, arg) arg_get_value_watched(m, arg)
+#else
+#define MEM_WRITE(m, addr, value) mem_write(m, addr, value)
+#define MEM_READ(m, addr) mem_read(m, addr)
+#define ARG_VALUE(m, arg) arg_get_value(m, arg)
+#endif
+
+//constant targets were resolved and range checked by build_blocks()
+#define JUMP_TARGET(m, entry) \
+    ((entry)->target >= 0 ? (entry)->target : jump_target(m, (entry)->arguments[0]))
+//a conditional jump that is not taken never goes to its target
+#define UNTAKEN_TARGET(m, entry) \
+    ((entry)->target >= 0 ? (entry)->target : add_get_value(m, (entry)->arguments[0]))
+
+int ENGINE_NAME(struct ami_machine* m, int count)
+{
+    int addr1, taken, steps, budget = count > 0;
+    struct block *block;
+    struct stack_entry *entry;
+    struct argument *args;
+#if ENGINE_CHECKED
+    char *error;
+#endif
+    for (;;) {
+        if (m->halted)
+            return -RUN_HALTED;
+
+        if (m->icount >= m->next_checkpoint)
+            take_checkpoint(m);
+
+        //instruction and time limits, Ctrl-C and loops, see watchdog.c
+        if (m->icount >= m->next_check && run_check(m))
+            return -RUN_BREAK;
+
+        if (is_breakpoint(m, m->PC)) {
+            return -RUN_BREAKPOINT;
+        }
+
+        //past the last instruction, data slots are not run
+        if (m->PC >= m->slots_used) {
+            m->halted = 1;
+            return -RUN_HALTED;
+        }
+
+        /*
+          Run the rest of the block holding PC.  Blocks with a
+          breakpoint inside, and the block the step budget runs out
+          in, are run an instruction at a time so the checks above
+          see every PC.
+         */
+        if (m->block_of[m->PC] == NO_BLOCK)
+            discover_block(m, m->PC);
+        block = &m->blocks[m->block_of[m->PC]];
+        block->entries++;
+        steps = block->end - m->PC;
+        if (block->breakpoints || (count > 0 && steps > count))
+            steps = 1;
+        if (count > 0)
+            count -= steps;
+
+        do {
+            m->nPC = m->PC + 1;
+
+            entry = &m->mem[m->PC];
+            args = entry->arguments;
+            PROBE2(dispatch, m->PC, entry->op);
+
+            if (TEXT_OUTPUT(m)) {
+                printf("%s\n", entry->instruction);
+            }
+
+#if ENGINE_CHECKED
+            if ((error = instruction_error(m, entry)))
+                raise(m, error);
+#endif
+
+            switch(entry->op) {
+            case HALT:
+                if (TEXT_OUTPUT(m)) {
+                    printf("HALT\n");
+                }
+                m->halted = 1;
+                break;
+            case WRITE:
+                if (m->opt_quiet) {
+                    addr1 = ARG_VALUE(m, args[0]);
+                    if (m->outputs)
+                        output_append(m->outputs, addr1);
+                } else if (m->opt_graphical) {
+                    m->console_io_value  = ARG_VALUE(m, args[0]);
+                    m->console_io_status = 2;
+                } else {
+                    printf("WRITE -> %i\n", ARG_VALUE(m, args[0]));
+                }
+                break;
+            case READB:
+                addr1 = mem_get_addr(m, args[0]);
+                MEM_WRITE(m, addr1, console_input(m) != 0);
+                if (TEXT_OUTPUT(m)) {
+                    printf("READB, mem[%i] <- %i\n", addr1, m->mem[addr1].data);
+                }
+                break;
+            case READI:
+                addr1 = mem_get_addr(m, args[0]);
+                MEM_WRITE(m, addr1, console_input(m));
+                if (TEXT_OUTPUT(m)) {
+                    printf("READI, mem[%i] <- %i\n", addr1, m->mem[addr1].data);
+                }
+                break;
+            case JUMP:
+                addr1 = JUMP_TARGET(m, entry);
+                m->nPC = addr1;
+                if (TEXT_OUTPUT(m)) {
+                    printf("JUMP to %i\n", addr1);
+                }
+                break;
+            case JUMPIF:
+                taken = ARG_VALUE(m, args[1]) != 0;
+                if (taken) {
+                    addr1 = JUMP_TARGET(m, entry);
+                    m->nPC = addr1;
+                    if (TEXT_OUTPUT(m)) {
+                        printf("JUMPIF to %i, COND TRUE\n", addr1);
+                    }
+                } else {
+                    addr1 = UNTAKEN_TARGET(m, entry);
+                    if (TEXT_OUTPUT(m)) {
+                        printf("JUMPIF to %i, COND FALSE\n", addr1);
+                    }
+                }
+#if ENGINE_HOOKS
+                if (m->bpred)
+                    bpred_branch(m, m->PC, taken, addr1);
+#endif
+                break;
+            case JUMPNIF:
+                taken = ARG_VALUE(m, args[1]) == 0;
+                if (taken) {
+                    addr1 = JUMP_TARGET(m, entry);
+                    m->nPC = addr1;
+                    if (TEXT_OUTPUT(m)) {
+                        printf("JUMPNIF to %i, COND TRUE\n", addr1);
+                    }
+                } else {
+                    addr1 = UNTAKEN_TARGET(m, entry);
+                    if (TEXT_OUTPUT(m)) {
+                    printf("JUMPNIF to %i, COND FALSE\n", addr1);
+                    }
+                }
+#if ENGINE_HOOKS
+                if (m->bpred)
+                    bpred_branch(m, m->PC, taken, addr1);
+#endif
+                break;
+            case MOVE:
+                if (args[0].type == REGISTER) {
+                    m->R[args[0].reg] = ARG_VALUE(m, args[1]);
+                    if (TEXT_OUTPUT(m)) {
+                        printf("MOVE, r%i <- %i\n", 
+                               args[0].reg, m->R[args[0].reg]);
+                    }
+                } else {
+                    addr1 = mem_get_addr(m, args[0]);
+                    MEM_WRITE(m, addr1,  ARG_VALUE(m, args[1]));
+                    if (TEXT_OUTPUT(m)) {
+                        printf("MOVE, mem[%i] <- %i\n",
+                               addr1, m->mem[addr1].data);
+                    }
+                }
+                break;
+            case LOAD:
+                addr1 = mem_get_addr(m, args[1]);
+                m->R[args[0].reg] = MEM_READ(m, addr1);
+                if (TEXT_OUTPUT(m)) {
+                    printf("LOAD, r%i <- %i\n", 
+                           args[0].reg, m->R[args[0].reg]);
+                }
+                break;
+            case STORE:
+                addr1 = mem_get_addr(m, args[0]);
+                MEM_WRITE(m, addr1, m->R[args[1].reg]);
+                if (TEXT_OUTPUT(m)) {
+                    printf("STORE, mem[%i] <- %i\n", 
+                           addr1, m->R[args[1].reg]);
+                }
+                break;
+            case IDM:
+                if (args[0].type == REGISTER) {
+                    m->R[args[0].reg] = args[1].number;
+                    if (TEXT_OUTPUT(m)) {
+                        printf("IDM, r%i <- %i\n", args[0].reg, args[1].number);
+                    }
+                } else {
+                    addr1 = mem_get_addr(m, args[0]);
+                    MEM_WRITE(m, addr1, args[1].number);
+                    if (TEXT_OUTPUT(m)) {
+                        printf("IDM, mem[%i] <- %i\n", addr1, args[1].number);
+                    }
+                }
+                break;
+            case EQ:
+                addr1 = args[0].reg;
+                if (ARG_VALUE(m, args[1]) == ARG_VALUE(m, args[2])) {
+                    m->R[addr1] = 1;
+                    if (TEXT_OUTPUT(m)) {
+                        printf("EQ, r%i <- true\n", addr1);
+                    }
+                } else {
+                    m->R[addr1] = 0;
+                    if (TEXT_OUTPUT(m)) {
+                        printf("EQ, r%i <- false\n", addr1);
+                    }
+                }
+                break;
+            case NEQ:
+                addr1 = args[0].reg;
+                if (ARG_VALUE(m, args[1]) == ARG_VALUE(m, args[2])) {
+                    m->R[addr1] = 1;
+                    if (TEXT_OUTPUT(m)) {
+                        printf("NEQ, r%i <- false\n", addr1);
+                    }
+                } else {
+                    m->R[addr1] = 0;
+                    if (TEXT_OUTPUT(m)) {
+                        printf("NEQ, r%i <- true\n", addr1);
+                    }
+                }
+                break;
+            case LT:
+                addr1 = args[0].reg;
+                if (ARG_VALUE(m, args[1]) < ARG_VALUE(m, args[2])) {
+                    m->R[addr1] = 1;
+                    if (TEXT_OUTPUT(m)) {
+                        printf("LT, r%i <- true\n", addr1);
+                    }
+                } else {
+                    m->R[addr1] = 0;
+                    if (TEXT_OUTPUT(m)) {
+                        printf("LT, r%i <- false\n", addr1);
+                    }
+                }
+                break;
+            case LTE:
+                addr1 = args[0].reg;
+                if (ARG_VALUE(m, args[1]) <= ARG_VALUE(m, args[2])) {
+                    m->R[addr1] = 1;
+                    if (TEXT_OUTPUT(m)) {
+                        printf("LTE, r%i <- true\n", addr1);
+                    }
+                } else {
+                    m->R[addr1] = 0;
+                    if (TEXT_OUTPUT(m)) {
+                        printf("LTE, r%i <- false\n", addr1);
+                    }
+                }
+                break;
+            case AND:
+                if (args[0].type == REGISTER) {
+                    addr1 = args[0].reg;
+                    if (ARG_VALUE(m, args[1]) != 0
+                        && ARG_VALUE(m, args[2]) != 0) {
+                        m->R[addr1] = 1;
+                        if (TEXT_OUTPUT(m)) {
+                            printf("AND, r%i <- true\n", addr1);
+                        }
+                    } else {
+                        m->R[addr1] = 0;
+                        if (TEXT_OUTPUT(m)) {
+                            printf("AND, r%i <- false\n", addr1);
+                        }
+                    } 
+                } else {
+                    addr1 = mem_get_addr(m, args[0]);
+                    if (ARG_VALUE(m, args[1]) != 0
+                        && ARG_VALUE(m, args[2]) != 0) {
+                        MEM_WRITE(m, addr1, 1);
+                        if (TEXT_OUTPUT(m)) {
+                            printf("AND, mem[%i] <- true\n", addr1);
+                        }
+                    } else {
+                        MEM_WRITE(m, addr1, 0);
+                        if (TEXT_OUTPUT(m)) {
+                            printf("AND, mem[%i] <- false\n", addr1);
+                        }
+                    } 
+                }
+                break;
+            case OR:
+                if (args[0].type == REGISTER) {
+                    addr1 = args[0].reg;
+                    if (ARG_VALUE(m, args[1]) != 0
+                        || ARG_VALUE(m, args[2]) != 0) {
+                        m->R[addr1] = 1;
+                        if (TEXT_OUTPUT(m)) {
+                            printf("OR, r%i <- true\n", addr1);
+                        }
+                    } else {
+                        m->R[addr1] = 0;
+                        if (TEXT_OUTPUT(m)) {
+                            printf("OR, r%i <- false\n", addr1);
+                        }
+                    }
+                } else {
+                    addr1 = mem_get_addr(m, args[0]);
+                    if (ARG_VALUE(m, args[1]) != 0
+                        || ARG_VALUE(m, args[2]) != 0) {
+                        MEM_WRITE(m, addr1, 1);
+                        if (TEXT_OUTPUT(m)) {
+                            printf("OR, mem[%i] <- true\n", addr1);
+                        }
+                    } else {
+                        MEM_WRITE(m, addr1, 0);
+                        if (TEXT_OUTPUT(m)) {
+                            printf("OR, mem[%i] <- false\n", addr1);
+                        }
+                    }
+                }
+                break;
+            case NOT:
+                if (args[0].type == REGISTER) {
+                    addr1 = args[0].reg;
+                    if (ARG_VALUE(m, args[1]) == 0) {
+                        m->R[addr1] = 1;
+                        if (TEXT_OUTPUT(m)) {
+                            printf("NOT, r%i <- true\n", addr1);
+                        }
+                    } else {
+                        m->R[addr1] = 0;
+                        if (TEXT_OUTPUT(m)) {
+                            printf("NOT, r%i <- false\n", addr1);
+                        }
+                    }
+                } else {
+                    addr1 = mem_get_addr(m, args[0]);
+                    if (ARG_VALUE(m, args[1]) == 0) {
+                        MEM_WRITE(m, addr1, 1);
+                        if (TEXT_OUTPUT(m)) {
+                            printf("NOT, mem[%i] <- true\n", addr1);
+                        }
+                    } else {
+                        MEM_WRITE(m, addr1, 0);
+                        if (TEXT_OUTPUT(m)) {
+                            printf("NOT, mem[%i] <- false\n", addr1);
+                        }
+                    }
+                }
+                break;
+            case ADD:
+                if (args[0].type == REGISTER) {
+                    addr1 = args[0].reg;
+                    m->R[addr1] = ARG_VALUE(m, args[1]) 
+                        + ARG_VALUE(m, args[2]);
+                    if (TEXT_OUTPUT(m)) {
+                        printf("ADD, r%i <- %i\n", addr1, m->R[addr1]);
+                    }
+                } else {
+                    addr1 = mem_get_addr(m, args[0]);
+                    MEM_WRITE(m, addr1, ARG_VALUE(m, args[1]) 
+                              + ARG_VALUE(m, args[2]));
+                    if (TEXT_OUTPUT(m)) {
+                        printf("ADD, mem[%i] <- %i\n", addr1, m->mem[addr1].data);
+                    }
+                }
+                break;
+            case SUB:
+                if (args[0].type == REGISTER) {
+                    addr1 = args[0].reg;
+                    m->R[addr1] = ARG_VALUE(m, args[1]) 
+                        - ARG_VALUE(m, args[2]);
+                    if (TEXT_OUTPUT(m)) {
+                        printf("SUB, r%i <- %i\n", addr1, m->R[addr1]);
+                    }
+                } else {
+                    addr1 = mem_get_addr(m, args[0]);
+                    MEM_WRITE(m, addr1, ARG_VALUE(m, args[1]) 
+                              - ARG_VALUE(m, args[2]));
+                    if (TEXT_OUTPUT(m)) {
+                        printf("SUB, mem[%i] <- %i\n", addr1, m->mem[addr1].data);
+                    }
+                }
+                break;
+            case MULT:
+                if (args[0].type == REGISTER) {
+                    addr1 = args[0].reg;
+                    m->R[addr1] = ARG_VALUE(m, args[1]) 
+                        * ARG_VALUE(m, args[2]);
+                    if (TEXT_OUTPUT(m)) {
+                        printf("MULT, r%i <- %i\n", addr1, m->R[addr1]);
+                    }
+                } else {
+                    addr1 = mem_get_addr(m, args[0]);
+                    MEM_WRITE(m, addr1, ARG_VALUE(m, args[1]) 
+                              * ARG_VALUE(m, args[2]));
+                    if (TEXT_OUTPUT(m)) {
+                        printf("MULT, mem[%i] <- %i\n", addr1, m->mem[addr1].data);
+                    }
+                }
+                break;
+            case DIV:
+                if (ARG_VALUE(m, args[2]) == 0) {
+                    raise(m, "Division by zero");
+                } else if (args[0].type == REGISTER) {
+                    addr1 = args[0].reg;
+                    m->R[addr1] = ARG_VALUE(m, args[1]) 
+                        / ARG_VALUE(m, args[2]);
+                    if (TEXT_OUTPUT(m)) {
+                        printf("DIV, r%i <- %i\n", addr1, m->R[addr1]);
+                    }
+                } else {
+                    addr1 = mem_get_addr(m, args[0]);
+                    MEM_WRITE(m, addr1, ARG_VALUE(m, args[1]) 
+                              / ARG_VALUE(m, args[2]));
+                    if (TEXT_OUTPUT(m)) {
+                        printf("DIV, mem[%i] <- %i\n", addr1, m->mem[addr1].data);
+                    }
+                }
+                break;
+            case NEG:
+                if (args[0].type == REGISTER) {
+                    addr1 = args[0].reg;
+                    m->R[addr1] = -1 * ARG_VALUE(m, args[1]);
+                    if (TEXT_OUTPUT(m)) {
+                        printf("NEG, r%i <- %i\n", addr1, m->R[addr1]);
+                    }
+                } else {
+                    addr1 = mem_get_addr(m, args[0]);
+                    MEM_WRITE(m, addr1, -1 * ARG_VALUE(m, args[1]));
+                    if (TEXT_OUTPUT(m)) {
+                        printf("NEG, mem[%i] <- %i\n", addr1, m->mem[addr1].data);
+                    }
+                }
+                break;
+            case NOP:
+                break;
+            default:
+                printf("Unknown opcode\n");
+            }
+
+#if ENGINE_HOOKS
+            if (m->trace)
+                trace_instruction(m, m->PC, entry);
+            if (m->timing)
+                timing_instruction(m, m->PC, entry);
+            if (m->loops && m->nPC <= m->PC)
+                loop_jump(m);
+#endif
+
+            m->PC = m->nPC;
+            m->icount++;
+
+#if ENGINE_HOOKS
+            if (m->watch_hit) {
+                m->watch_hit = 0;
+                return -RUN_WATCHPOINT;
+            }
+#endif
+        } while (--steps);
+
+        //ensures only count instructions are executed
+        if (count == 0 && budget)
+            return -RUN_OK;
+    }
+}
+
+
+#undef MEM_WRITE
+#undef MEM_READ
+#undef ARG_VALUE
+#undef JUMP_TARGET
+#undef UNTAKEN_TARGET
+#undef ENGINE_NAME
+#undef ENGINE_HOOKS
+#undef ENGINE_CHECKED
@@ -0,0 +1,292 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Exploring alternative inputs ('explore').  The machine is run to
+  the next READB or READI once; then the simulator forks a child per
+  candidate value.  Each child shares the decoded program and memory
+  with the parent copy-on-write, reads its value at that instruction
+  and runs quietly until it halts, reaches another input instruction,
+  stops at a breakpoint or uses up its instruction budget.  It sends
+  its final state and everything it wrote back over a pipe.  As many
+  children run at once as there are processors, and the parent's own
+  state is left at the input instruction.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+//<sys/wait.h> pulls in <signal.h>, whose raise() clashes with sim.h's
+#define raise signal_raise
+#include <sys/wait.h>
+#undef raise
+
+#include "sim.h"
+
+#define EXPLORE_MAX_OUTPUTS 64//values reported per child
+
+enum { EXPLORE_HALTED, EXPLORE_INPUT, EXPLORE_BREAKPOINT, EXPLORE_BUDGET,
+       EXPLORE_WATCHPOINT, EXPLORE_FAULT };
+
+static char *status_names[] = {
+  "halted", "input", "breakpoint", "budget", "watchpoint", "fault"
+};
+
+struct explore_result {
+  int input, status;
+  unsigned long icount;
+  unsigned int PC;
+  int R[MAX_REGISTERS];
+  unsigned long output_count;//may be more than were sent
+  int outputs[EXPLORE_MAX_OUTPUTS];
+};
+
+struct explore_child {
+  pid_t pid;
+  int fd, input;
+  struct explore_result result;
+  size_t received;
+};
+
+void output_append(struct output_log *log, int value) {
+  if (log->count < log->capacity)
+    log->values[log->count] = value;
+  log->count++;
+}
+
+/*
+  Whether the instruction at pc reads input.  With -l a slot not run
+  yet has not been decoded, so its text is decoded here.
+ */
+int is_input(struct ami_machine *m, unsigned int pc) {
+  struct stack_entry e;
+  int reg_count = m->reg_count;
+
+  if (pc >= m->slots_used)
+    return 0;
+  if (m->block_of[pc] != NO_BLOCK)
+    return m->mem[pc].op == READB || m->mem[pc].op == READI;
+  decode_instr(m->mem[pc].instruction, &e, &reg_count);
+  return e.op == READB || e.op == READI;
+}
+
+/*
+  Puts a stop (a breakpoint numbered 0, so never listed for long)
+  on every input instruction without a breakpoint of its own
+ */
+static void stop_at_inputs(struct ami_machine *m) {
+  struct breakpoint *b;
+  unsigned int pc;
+
+  for (pc = 0; pc < m->slots_used; pc++) {
+    if (!is_input(m, pc) || find_breakpoint(m, pc))
+      continue;
+    b = calloc(1, sizeof(struct breakpoint));
+    b->enabled = 1;
+    b->addr = pc;
+    b->next = m->breakpoints;
+    m->breakpoints = b;
+  }
+  mark_breakpoint_blocks(m);
+}
+
+static void clear_input_stops(struct ami_machine *m) {
+  struct breakpoint **pprev = &m->breakpoints, *b;
+
+  while ((b = *pprev) != NULL) {
+    if (b->id == 0) {
+      *pprev = b->next;
+      free(b);
+    } else {
+      pprev = &b->next;
+    }
+  }
+  mark_breakpoint_blocks(m);
+}
+
+/*
+  Runs in the child: feeds input to the instruction at PC and runs
+  on from there, then writes the result to fd
+ */
+static void explore_child(struct ami_machine *m, int input, int budget, int fd) {
+  struct explore_result r;
+  struct output_log log;
+  int null = open("/dev/null", O_RDWR), ret;
+
+  //nothing from the child reaches the terminal or reads from it
+  dup2(null, 0);
+  dup2(null, 1);
+  m->opt_quiet = 1;
+  m->opt_graphical = 0;
+  m->escape = NULL;//a server's handler is in the parent
+
+  memset(&r, 0, sizeof(r));
+  log.values = r.outputs;
+  log.capacity = EXPLORE_MAX_OUTPUTS;
+  log.count = 0;
+  m->outputs = &log;
+
+  io_log_insert(m, input);
+  stop_at_inputs(m);
+  skip_breakpoint(m);
+  ret = _run(m, budget);
+
+  r.input = input;
+  if (ret == -RUN_HALTED)
+    r.status = EXPLORE_HALTED;
+  else if (ret == -RUN_BREAKPOINT)
+    r.status = is_input(m, m->PC) ? EXPLORE_INPUT : EXPLORE_BREAKPOINT;
+  else if (ret == -RUN_WATCHPOINT)
+    r.status = EXPLORE_WATCHPOINT;
+  else
+    r.status = EXPLORE_BUDGET;
+  r.icount = m->icount;
+  r.PC = m->PC;
+  memcpy(r.R, m->R, sizeof(r.R));
+  r.output_count = log.count;
+
+  write(fd, &r, sizeof(r));
+  _exit(0);
+}
+
+static void print_result(struct ami_machine *m, struct explore_result *r) {
+  unsigned long i;
+  int reg;
+
+  printf("%8d  %-10s  %12lu  %4u ", r->input, status_names[r->status], r->icount, r->PC);
+  if (r->status == EXPLORE_FAULT) {
+    printf("\n");
+    return;
+  }
+  printf(" out:");
+  for (i = 0; i < r->output_count && i < EXPLORE_MAX_OUTPUTS; i++)
+    printf(" %d", r->outputs[i]);
+  if (r->output_count > EXPLORE_MAX_OUTPUTS)
+    printf(" ... (%lu in all)", r->output_count);
+  printf("  regs:");
+  for (reg = 1; reg < m->reg_count; reg++)
+    printf(" %d", r->R[reg]);
+  printf("\n");
+}
+
+static int start_child(struct ami_machine *m, struct explore_child *c, int input,
+                       int budget) {
+  int fds[2];
+
+  if (pipe(fds) < 0)
+    return -1;
+  fflush(stdout);
+  c->pid = fork();
+  if (c->pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  if (c->pid == 0) {
+    close(fds[0]);
+    explore_child(m, input, budget, fds[1]);
+  }
+  close(fds[1]);
+  c->fd = fds[0];
+  c->input = input;
+  c->received = 0;
+  memset(&c->result, 0, sizeof(c->result));
+  return 0;
+}
+
+/*
+  Reads what the child has sent; at end of file reaps it, prints its
+  result and returns 1
+ */
+static int collect_child(struct ami_machine *m, struct explore_child *c) {
+  ssize_t n = 0;
+  int status;
+
+  if (c->received < sizeof(c->result))
+    n = read(c->fd, (char *)&c->result + c->received, sizeof(c->result) - c->received);
+  if (n > 0) {
+    c->received += n;
+    return 0;
+  }
+
+  close(c->fd);
+  waitpid(c->pid, &status, 0);
+  if (c->received < sizeof(c->result)) {
+    //raise() exits without sending anything
+    memset(&c->result, 0, sizeof(c->result));
+    c->result.input = c->input;
+    c->result.status = EXPLORE_FAULT;
+  }
+  print_result(m, &c->result);
+  return 1;
+}
+
+/*
+  Tries each of the count values at the next input instruction
+ */
+void explore_inputs(struct ami_machine *m, int *values, int count, int budget) {
+  struct explore_child *children;
+  struct pollfd *fds;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int running = 0, next = 0, i, ret;
+
+  if (!m->history) {
+    printf("exploring needs the input log, which is off\n");
+    return;
+  }
+  if (!is_input(m, m->PC)) {
+    stop_at_inputs(m);
+    ret = run(m, 0);
+    clear_input_stops(m);
+    if (ret != -RUN_BREAKPOINT || !is_input(m, m->PC)) {
+      printf("not at an input instruction, nothing explored\n");
+      return;
+    }
+  }
+
+  if (cpus < 1)
+    cpus = 1;
+  children = calloc(cpus, sizeof(struct explore_child));
+  fds = calloc(cpus, sizeof(struct pollfd));
+  if (!children || !fds) {
+    printf("out of memory\n");
+    free(children);
+    free(fds);
+    return;
+  }
+
+  printf("exploring %d input%s at pc %u, %ld at a time\n", count, count == 1 ? "" : "s",
+         m->PC, cpus);
+  printf("   input  status      instructions    pc\n");
+
+  while (next < count || running > 0) {
+    while (next < count && running < cpus) {
+      if (start_child(m, &children[running], values[next], budget) < 0) {
+        perror("Cannot start explorer");
+        next = count;
+        break;
+      }
+      next++;
+      running++;
+    }
+
+    for (i = 0; i < running; i++) {
+      fds[i].fd = children[i].fd;
+      fds[i].events = POLLIN;
+    }
+    if (running == 0 || poll(fds, running, -1) < 0)
+      continue;
+
+    for (i = running - 1; i >= 0; i--) {
+      if (fds[i].revents && collect_child(m, &children[i]))
+        children[i] = children[--running];
+    }
+  }
+
+  free(children);
+  free(fds);
+}
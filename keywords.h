@@ -0,0 +1,27 @@
+// generated by keywords.pl; do not edit
+
+#define KEYWORD_TABLE_SIZE 32
+#define KEYWORD_HASH(s, len) \
+  (((len) * 1 + (unsigned char)(s)[0] * 19 + (unsigned char)(s)[(len) - 1] * 10) & (32 - 1))
+
+static const struct keyword keyword_table[KEYWORD_TABLE_SIZE] = {
+  [0] = { "+", 1, K_BINOP, ADD },
+  [1] = { "/=", 2, K_BINOP, NEQ },
+  [3] = { "*", 1, K_BINOP, MULT },
+  [4] = { "halt", 4, K_HALT, HALT },
+  [9] = { "if", 2, K_IF, 0 },
+  [10] = { "=", 1, K_BINOP, EQ },
+  [12] = { "write", 5, K_WRITE, WRITE },
+  [13] = { "<", 1, K_BINOP, LT },
+  [14] = { "read_boolean", 12, K_READ, READB },
+  [16] = { "pc", 2, K_PC, 0 },
+  [18] = { ":=", 2, K_ASSIGN, 0 },
+  [19] = { "or", 2, K_BINOP, OR },
+  [20] = { "/", 1, K_BINOP, DIV },
+  [21] = { "not", 3, K_NOT, NOT },
+  [22] = { "read_integer", 12, K_READ, READI },
+  [24] = { "<=", 2, K_BINOP, LTE },
+  [26] = { "-", 1, K_MINUS, SUB },
+  [30] = { "and", 3, K_BINOP, AND },
+  [31] = { "contents", 8, K_CONTENTS, 0 },
+};
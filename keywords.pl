@@ -0,0 +1,71 @@
+#!/usr/bin/perl
+# Generates keywords.h, the perfect hash table of AMI mnemonics and
+# operators used by the decoder in disasm.c.
+#
+# The hash of a word of length len is
+#   (len * A + first * B + last * C) & (SIZE - 1)
+# and this script searches for the smallest table SIZE and constants
+# A, B, C under which no two keywords collide.
+
+use strict;
+
+# keyword, token kind, opcode for operators
+my @keywords = (
+  ['halt', 'K_HALT', 'HALT'],
+  ['write', 'K_WRITE', 'WRITE'],
+  ['read_boolean', 'K_READ', 'READB'],
+  ['read_integer', 'K_READ', 'READI'],
+  ['pc', 'K_PC', '0'],
+  ['contents', 'K_CONTENTS', '0'],
+  ['if', 'K_IF', '0'],
+  ['not', 'K_NOT', 'NOT'],
+  [':=', 'K_ASSIGN', '0'],
+  ['-', 'K_MINUS', 'SUB'],
+  ['and', 'K_BINOP', 'AND'],
+  ['or', 'K_BINOP', 'OR'],
+  ['=', 'K_BINOP', 'EQ'],
+  ['/=', 'K_BINOP', 'NEQ'],
+  ['<', 'K_BINOP', 'LT'],
+  ['<=', 'K_BINOP', 'LTE'],
+  ['+', 'K_BINOP', 'ADD'],
+  ['*', 'K_BINOP', 'MULT'],
+  ['/', 'K_BINOP', 'DIV'],
+);
+
+sub hash {
+  my ($word, $a, $b, $c, $size) = @_;
+  return (length($word) * $a + ord($word) * $b + ord(substr($word, -1)) * $c) & ($size - 1);
+}
+
+my ($size, $a, $b, $c);
+SEARCH:
+for ($size = 32; $size <= 1024; $size *= 2) {
+  for my $i (0..31) {
+    for my $j (1..31) {
+      for my $k (0..31) {
+        my %seen;
+        my $ok = 1;
+        for my $kw (@keywords) {
+          if ($seen{hash($kw->[0], $i, $j, $k, $size)}++) { $ok = 0; last; }
+        }
+        if ($ok) { ($a, $b, $c) = ($i, $j, $k); last SEARCH; }
+      }
+    }
+  }
+}
+die "no perfect hash found\n" unless defined $a;
+
+my @table;
+$table[hash($_->[0], $a, $b, $c, $size)] = $_ for @keywords;
+
+print "// generated by keywords.pl; do not edit\n\n";
+print "#define KEYWORD_TABLE_SIZE $size\n";
+print "#define KEYWORD_HASH(s, len) \\\n";
+print "  (((len) * $a + (unsigned char)(s)[0] * $b + (unsigned char)(s)[(len) - 1] * $c) & ($size - 1))\n\n";
+print "static const struct keyword keyword_table[KEYWORD_TABLE_SIZE] = {\n";
+for my $i (0 .. $size - 1) {
+  next unless $table[$i];
+  my ($word, $kind, $op) = @{$table[$i]};
+  printf "  [%d] = { \"%s\", %d, %s, %s },\n", $i, $word, length($word), $kind, $op;
+}
+print "};\n";
@@ -22,7 +22,7 @@ int main(int ac, char **av)
   m->opt_printstack = -1;
 
   if (ac <= 0) {
-    printf("Usage: ./sim {FLAGS} FILENAME\n");
+    printf("Usage: ./sim {-t} {-u} {-O} {-l} {-x SCRIPT} {-b REPS} {-C} {-p PREDICTOR} {-P PROFILE} {-r SNAPSHOT} {-S SNAPSHOT} {-s SOCKET} {-m STEPS} {-w SECONDS} {-L} FILENAME\n");
     exit(1);
   } else {
     if (ac > 1) {
@@ -35,15 +35,95 @@ int main(int ac, char **av)
 
 	if (!strcmp(flag, "t")) {
 	  m->opt_graphical = 0;
+	} else if (!strcmp(flag, "l")) {
+	  m->opt_lazy = 1;
+	} else if (!strcmp(flag, "O")) {
+	  m->opt_optimize = 1;
+	} else if (!strcmp(flag, "C")) {
+	  m->opt_counters = 1;
+	} else if (!strcmp(flag, "L")) {
+	  set_loop_detection(m, 1);
+	} else if (!strcmp(flag, "m") && ac > 2) {
+	  m->max_steps = atol(*(av++));
+	  ac--;
+	} else if (!strcmp(flag, "w") && ac > 2) {
+	  m->max_seconds = atof(*(av++));
+	  ac--;
+	} else if (!strcmp(flag, "u")) {
+	  m->opt_noverify = 1;
+	} else if (!strcmp(flag, "x") && ac > 2) {
+	  m->script = *(av++);
+	  ac--;
+	} else if (!strcmp(flag, "b") && ac > 2) {
+	  m->opt_bench = atoi(*(av++));
+	  ac--;
+	} else if (!strcmp(flag, "r") && ac > 2) {
+	  m->restore = *(av++);
+	  ac--;
+	} else if (!strcmp(flag, "S") && ac > 2) {
+	  m->save = *(av++);
+	  ac--;
+	} else if (!strcmp(flag, "s") && ac > 2) {
+	  m->serve = *(av++);
+	  ac--;
+	} else if (!strcmp(flag, "P") && ac > 2) {
+	  m->profile = *(av++);
+	  ac--;
+	} else if (!strcmp(flag, "p") && ac > 2) {
+	  if (bpred_kind(*av) < 0) {
+	    printf("Unknown branch predictor %s\n", *av);
+	    exit(1);
+	  }
+	  m->bpred = bpred_create(bpred_kind(*(av++)), BPRED_DEFAULT_ENTRIES, 0, 0);
+	  ac--;
 	}
       }
     }
   }
 
   m->filename = strdup(*av);
+  if (m->profile)
+    profile_start(m, m->profile);
+
+  if (m->opt_bench > 0) {
+    //time the engine alone: no output, GUI or reverse execution history
+    m->opt_graphical = 0;
+    m->opt_quiet = 1;
+    m->opt_optimize = 1;
+    free(m->history);
+    m->history = NULL;
+    history_reset(m);
+    allocate_stack(m);
+    if (m->opt_counters)
+      run_counters(m, m->opt_bench);
+    else
+      run_benchmark(m, m->opt_bench);
+    return 0;
+  }
+
+  //debug sessions show the program as written, not as optimized
+  if (m->opt_optimize) {
+    printf("-O only applies to benchmark runs (-b), ignored\n");
+    m->opt_optimize = 0;
+  }
+
+  if (m->serve) {
+    run_server(m, m->serve);
+    return 0;
+  }
 
   printf("Filename: %s\n", m->filename);
   allocate_stack(m);
+  if (m->restore) {
+    int status = snapshot_load(m, m->restore);
+    if (status < 0)
+      perror(m->restore);
+    if (status != 0)
+      exit(1);
+    printf("Restored state from %s\n", m->restore);
+  }
+  if (m->save)
+    snapshot_at_exit(m, m->save);
 
   if (m->opt_graphical == 1) {
     /*if(pipe(pfd1) == -1 || pipe(pfd2) == -1) {
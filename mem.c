@@ -8,12 +8,15 @@
 #include <string.h>
 
 #include "sim.h"
+#include "probes.h"
 
 int arg_get_value(struct ami_machine *m, struct argument arg) {
   if (arg.type == REGISTER) {
     return m->R[arg.reg];
   } else if (arg.type == ADDRESS) {
-    return m->mem[mem_get_addr(m, arg)].data;
+    int addr = mem_get_addr(m, arg);
+    PROBE2(mem_read, addr, m->mem[addr].data);
+    return m->mem[addr].data;
   } else {
     raise(m, "Non register/address argument supplied");
   }
@@ -29,6 +32,7 @@ int add_get_value(struct ami_machine *m, struct argument add) {
 
 int mem_read(struct ami_machine *m, unsigned int addr) {
   if (m->mem[addr].data_type == DATA) {
+    PROBE2(mem_read, addr, m->mem[addr].data);
     return m->mem[addr].data;
   } else {
     raise(m, "Inappropriate memory access, attempted to overwrite instruction");
@@ -50,6 +54,8 @@ int mem_get_addr(struct ami_machine *m, struct argument arg) {
 	sum += arg.add[i].value;
       }
     }
+    if (sum < 0 || sum >= STACK_SIZE)
+      raise(m, "Address out of range");
     return sum;
   }
 }
@@ -60,23 +66,82 @@ void mem_write(struct ami_machine *m, unsigned int addr, int value) {
   } else {
     m->mem[addr].data_type == DATA;
     m->mem[addr].data = value;
+    PROBE2(mem_write, addr, value);
   }
 }
 
-char * read_stack_entry(struct ami_machine *m, int addr) {
-  char * memValue;
+/*
+  Variants of the accessors above used by the hooked engine.  They
+  note an access to a watched address so that the engine stops
+  after the current instruction completes, and pass every access to
+  the cache model when one is configured.
+ */
+static void watch_trigger(struct ami_machine *m, unsigned int addr, int kind, int old) {
+  m->watch_hit = 1;
+  m->watch_addr = addr;
+  m->watch_kind = kind;
+  m->watch_old = old;
+}
+
+static void watch_read(struct ami_machine *m, unsigned int addr) {
+  if (m->cache)
+    cache_access(m, addr, 0);
+  if (addr < STACK_SIZE && (m->watch[addr] & WATCH_READ))
+    watch_trigger(m, addr, WATCH_READ, m->mem[addr].data);
+}
+
+int arg_get_value_watched(struct ami_machine *m, struct argument arg) {
+  if (arg.type == ADDRESS) {
+    int addr = mem_get_addr(m, arg);
+    watch_read(m, addr);
+    return m->mem[addr].data;
+  }
+  return arg_get_value(m, arg);
+}
+
+int mem_read_watched(struct ami_machine *m, unsigned int addr) {
+  watch_read(m, addr);
+  return mem_read(m, addr);
+}
+
+void mem_write_watched(struct ami_machine *m, unsigned int addr, int value) {
+  int old = m->mem[addr].data;
+  mem_write(m, addr, value);
+  if (m->cache)
+    cache_access(m, addr, 1);
+  if (m->loops)
+    loop_write(m, addr);
+  if (addr < STACK_SIZE && (m->watch[addr] & WATCH_WRITE))
+    watch_trigger(m, addr, WATCH_WRITE, old);
+}
+
+void set_watchpoint(struct ami_machine *m, unsigned int addr, int kind) {
+  if (m->watch[addr] && !kind)
+    m->watch_count--;
+  else if (!m->watch[addr] && kind)
+    m->watch_count++;
+  m->watch[addr] = kind;
+  select_engine(m);
+}
+
+void show_watchpoint(struct ami_machine *m) {
+  unsigned int addr = m->watch_addr;
+  if (m->watch_kind == WATCH_WRITE)
+    printf("watchpoint at address %u: %i -> %i\n", addr, m->watch_old, m->mem[addr].data);
+  else
+    printf("read watchpoint at address %u: value %i\n", addr, m->mem[addr].data);
+}
 
+/*
+  Text of a stack slot for the GUI, valid until the scratch arena is
+  next reset
+ */
+char * read_stack_entry(struct ami_machine *m, int addr) {
   if (m->mem[addr].data_type == INSTRUCTION) {
-    memValue = (char *) malloc(strlen(m->mem[addr].instruction) + 1);
-    strcpy(memValue, m->mem[addr].instruction);
+    return m->mem[addr].instruction;
   } else {
-    char buffer[80];
-    sprintf(buffer, "%i: %i", addr, m->mem[addr].data);
-    memValue = (char*) malloc(strlen(buffer) + 1);
-    strcpy(memValue, buffer);
+    return arena_printf(&m->scratch, "%i: %i", addr, m->mem[addr].data);
   }
-
-  return memValue;
 }
 
 void dump_segments(struct ami_machine *m) {
@@ -115,34 +180,112 @@ void free_segments(struct ami_machine *m)
   }
 }
 
+static void load_failed(struct ami_machine *m) __attribute__ ((noreturn));
+static void load_failed(struct ami_machine *m)
+{
+  if (m->escape)
+    longjmp(*m->escape, RUN_EXIT);
+  exit(1);
+}
+
 void allocate_stack(struct ami_machine *m)
 {
-  char *line;
-  int line_count = 0;
+  char *line, *next;
+  int line_count = 0, source_line = 0, errors;
 
-  char *file = readfile(m->filename);
-  
+  struct arena swap;
+  char *file;
   int i;
+
+  PROBE1(load_start, m->filename);
+
+  //the text is read into the spare arena, so the slots still point
+  //at valid text if the read fails; everything from the previous
+  //load then goes at once
+  arena_reset(&m->spare);
+  file = readfile(m->filename, &m->spare);
+  if (!file)
+    load_failed(m);
+  swap = m->program;
+  m->program = m->spare;
+  m->spare = swap;
+  arena_reset(&m->spare);
+
+  //nothing of a longer program loaded before may show through
+  m->slots_used = 0;
   for (i = 0; i < STACK_SIZE; i++) {
+    memset(&m->mem[i], 0, sizeof(m->mem[i]));
     m->mem[i].data_type = DATA;
+    m->mem[i].target = -1;
   }
 
-  line = strtok(file, "\n");
+  //empty lines are skipped, so slot numbers count instructions
+  for (line = file; *line; line = next) {
+    next = strchr(line, '\n');
+    if (next)
+      *next++ = '\0';
+    else
+      next = line + strlen(line);
+    source_line++;
+    if (*line == '\0')
+      continue;
 
-  while (line != NULL) {
-    m->mem[line_count].instruction = (char*) malloc(strlen(line) + 1);
-    strcpy(m->mem[line_count].instruction, line);
+    if (line_count == STACK_SIZE) {
+      printf("Program does not fit in %d memory slots\n", STACK_SIZE);
+      load_failed(m);
+    }
 
-    line = strtok(NULL, "\n");
+    //decode_program() or, lazily, discover_block() decodes the text
+    if (!m->opt_lazy && !m->opt_quiet)
+      printf("Disassembling line %i\n", line_count);
+    m->mem[line_count].instruction = line;
+    m->mem[line_count].data_type = INSTRUCTION;
+    m->mem[line_count].line = source_line;
     line_count++;
   }
 
-  for (i = 0; i < line_count; i++) {
-    printf("Disassembling line %i\n", i);
-    m->mem[i] = disasm_instr(m, m->mem[i].instruction);
+  m->slots_used = line_count;
+
+  if (m->opt_lazy) {
+    //each block is verified as it is decoded
+    m->verified = 1;
+    forget_blocks(m);
+    select_engine(m);
+    PROBE2(load_done, m->filename, m->slots_used);
+    return;
   }
+  decode_program(m);
 
-  m->slots_used = line_count;
+  //with -u, bad instructions are reported again when they are reached
+  errors = verify_program(m);
+  m->verified = errors == 0;
+  if (errors && !m->opt_noverify) {
+    printf("%d bad instruction%s, use -u to run anyway\n", errors, errors == 1 ? "" : "s");
+    load_failed(m);
+  }
+  if (m->verified && m->opt_optimize) {
+    int removed = optimize_program(m);
+    if (!m->opt_quiet)
+      printf("Optimizer removed %d instructions\n", removed);
+  }
+  build_blocks(m);
+  select_engine(m);
+  PROBE2(load_done, m->filename, m->slots_used);
+}
+
+/*
+  Returns the machine to its state before the first instruction,
+  reloading the program from its file.  Breakpoints are kept.
+ */
+void reset_machine(struct ami_machine *m)
+{
+  unskip_breakpoints(m);
+  memset(m->R, 0, sizeof(m->R));
+  m->PC = m->nPC = 0;
+  m->halted = 0;
+  history_reset(m);
+  free_segments(m);
+  allocate_stack(m);
 }
 
 void push_arguments(struct ami_machine *m)
@@ -154,5 +297,7 @@ void push_arguments(struct ami_machine *m)
 struct ami_machine *create_ami_machine()
 {
   struct ami_machine *m = calloc(sizeof(struct ami_machine), 1);
+  m->history = history_create();
+  history_reset(m);
   return m;
 }
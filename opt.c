@@ -0,0 +1,337 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Peephole optimizer.  Each basic block of a verified program is
+  rewritten in place, one instruction per slot, so every PC still
+  holds the instruction (and source text) it was loaded from and
+  breakpoints, 'info stack' and the GUI show the source program.
+  Within a block it does:
+
+    constant propagation  registers set by 'r := N' are replaced by
+                          their value, and instructions whose
+                          operands are all known become 'r := N'
+                          (or 'contents ... := N')
+    copy propagation      after 'r2 := r1', reads of r2 read r1
+    branch folding        jumps on a known condition become a
+                          'pc := N' or nothing
+    dead stores           a register or constant address written
+                          again before it is read loses the first
+                          write
+
+  Removed instructions become NOPs.  Nothing is carried from one
+  block to the next, and programs with jumps computed from registers
+  are left alone because those can enter a block anywhere.
+
+  Registers and memory only match the source program at block
+  boundaries, so the optimizer is for batch runs, not debug
+  sessions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+struct optimizer {
+  struct ami_machine *m;
+  char known[MAX_REGISTERS];//register holds value[]
+  int value[MAX_REGISTERS];
+  int copy[MAX_REGISTERS];//register holds the same value as copy[], or -1
+  int def[MAX_REGISTERS];//slot of an unread, removable write, or -1
+  int store[STACK_SIZE];//slot of an unread, removable store, or -1
+  char written[MAX_REGISTERS];//some instruction writes the register
+  int removed;
+};
+
+/*
+  Starts a block knowing only that registers no instruction writes,
+  such as a base register b left at 0, still hold 0
+ */
+static void forget(struct optimizer *o) {
+  int i;
+  for (i = 0; i < MAX_REGISTERS; i++) {
+    o->known[i] = !o->written[i];
+    o->value[i] = 0;
+    o->copy[i] = o->def[i] = -1;
+  }
+  for (i = 0; i < STACK_SIZE; i++)
+    o->store[i] = -1;
+}
+
+static void remove_slot(struct optimizer *o, int pc) {
+  o->m->mem[pc].op = NOP;
+  o->removed++;
+}
+
+static int is_const(struct optimizer *o, struct argument *arg, int *value) {
+  if (arg->type != REGISTER || !o->known[arg->reg])
+    return 0;
+  *value = o->value[arg->reg];
+  return 1;
+}
+
+/*
+  Replaces known registers in an address by displacements, and
+  copies by their originals
+ */
+static void rewrite_address(struct optimizer *o, struct argument *arg) {
+  int i, r;
+  for (i = 0; i < arg->addc; i++) {
+    if (arg->add[i].type != REG)
+      continue;
+    r = arg->add[i].value;
+    if (o->known[r]) {
+      arg->add[i].type = DISP;
+      arg->add[i].value = o->value[r];
+    } else if (o->copy[r] >= 0) {
+      arg->add[i].value = o->copy[r];
+    }
+  }
+}
+
+static void rewrite_source(struct optimizer *o, struct argument *arg) {
+  if (arg->type == REGISTER && o->copy[arg->reg] >= 0)
+    arg->reg = o->copy[arg->reg];
+  else if (arg->type == ADDRESS)
+    rewrite_address(o, arg);
+}
+
+/*
+  Notes the registers an operand reads, and the memory slot if it
+  reads one.  A slot that cannot be worked out may be any of them.
+ */
+static void use_address(struct optimizer *o, struct argument *arg) {
+  int i;
+  for (i = 0; i < arg->addc; i++)
+    if (arg->add[i].type == REG)
+      o->def[arg->add[i].value] = -1;
+}
+
+static void use_source(struct optimizer *o, struct argument *arg) {
+  int addr;
+
+  if (arg->type == REGISTER) {
+    o->def[arg->reg] = -1;
+  } else if (arg->type == ADDRESS) {
+    use_address(o, arg);
+    if (constant_target(arg, &addr) && addr >= 0 && addr < STACK_SIZE) {
+      o->store[addr] = -1;
+    } else {
+      for (addr = 0; addr < STACK_SIZE; addr++)
+        o->store[addr] = -1;
+    }
+  }
+}
+
+static int sources(struct stack_entry *e) {
+  switch (e->op) {
+  case NOT:
+  case NEG:
+  case MOVE:
+  case LOAD:
+  case STORE:
+    return 1;
+  case AND: case OR: case EQ: case NEQ: case LT: case LTE:
+  case ADD: case SUB: case MULT: case DIV:
+    return 2;
+  }
+  return 0;
+}
+
+static int fold(int op, int a, int b, int *result) {
+  switch (op) {
+  case AND: *result = a != 0 && b != 0; break;
+  case OR: *result = a != 0 || b != 0; break;
+  case NOT: *result = a == 0; break;
+  case EQ: *result = a == b; break;
+  case NEQ: *result = a == b; break;//as the engine does
+  case LT: *result = a < b; break;
+  case LTE: *result = a <= b; break;
+  case ADD: *result = a + b; break;
+  case SUB: *result = a - b; break;
+  case MULT: *result = a * b; break;
+  case DIV:
+    if (b == 0)
+      return 0;//leave the fault to run time
+    *result = a / b;
+    break;
+  case NEG: *result = -1 * a; break;
+  case MOVE:
+  case STORE: *result = a; break;
+  default:
+    return 0;
+  }
+  return 1;
+}
+
+static void make_idm(struct stack_entry *e, int value) {
+  e->op = IDM;
+  e->argc = 2;
+  e->arguments[1].type = NUMBER;
+  e->arguments[1].number = value;
+}
+
+/*
+  Turns e into 'dst := src', choosing the opcode the decoder would
+ */
+static void make_copy(struct stack_entry *e, struct argument *src) {
+  int dst = e->arguments[0].type;
+
+  e->arguments[1] = *src;
+  e->argc = 2;
+  if (dst == REGISTER && src->type == ADDRESS)
+    e->op = LOAD;
+  else if (dst == ADDRESS && src->type == REGISTER)
+    e->op = STORE;
+  else
+    e->op = MOVE;
+}
+
+/*
+  x + 0, 0 + x, x - 0, x * 1 and 1 * x are copies of x.  Only
+  registers are copied, since a load checks what it reads and the
+  arithmetic does not.
+ */
+static void simplify(struct optimizer *o, struct stack_entry *e) {
+  struct argument *args = e->arguments;
+  int a = 0, b = 0, ka = is_const(o, &args[1], &a), kb = is_const(o, &args[2], &b);
+
+  if (((e->op == ADD && kb && b == 0) || (e->op == SUB && kb && b == 0)
+       || (e->op == MULT && kb && b == 1)) && args[1].type == REGISTER)
+    make_copy(e, &args[1]);
+  else if (((e->op == ADD && ka && a == 0) || (e->op == MULT && ka && a == 1))
+           && args[2].type == REGISTER)
+    make_copy(e, &args[2]);
+}
+
+static void optimize_instruction(struct optimizer *o, int pc) {
+  struct stack_entry *e = &o->m->mem[pc];
+  struct argument *args = e->arguments;
+  int n = sources(e), a, b = 0, value, i, d, addr;
+
+  //operands
+  if (e->op == STORE) {
+    rewrite_address(o, &args[0]);
+    rewrite_source(o, &args[1]);
+  } else if (e->op == WRITE) {
+    rewrite_source(o, &args[0]);
+  } else if (e->op == JUMPIF || e->op == JUMPNIF) {
+    rewrite_source(o, &args[1]);
+  } else if (e->op == READB || e->op == READI || n > 0 || e->op == IDM) {
+    if (args[0].type == ADDRESS)
+      rewrite_address(o, &args[0]);
+    for (i = 1; i <= n; i++)
+      rewrite_source(o, &args[i]);
+  }
+
+  //folding
+  if (n > 0 && e->op != LOAD && is_const(o, &args[1], &a)
+      && (n == 1 || is_const(o, &args[2], &b)) && fold(e->op, a, b, &value)) {
+    make_idm(e, value);
+    n = 0;
+  } else if (e->op == ADD || e->op == SUB || e->op == MULT) {
+    simplify(o, e);
+    n = sources(e);
+  } else if ((e->op == JUMPIF || e->op == JUMPNIF) && is_const(o, &args[1], &a)) {
+    if ((a != 0) == (e->op == JUMPIF)) {
+      e->op = JUMP;
+      e->argc = 1;
+    } else {
+      remove_slot(o, pc);
+      return;
+    }
+  }
+
+  //reads
+  if (e->op == WRITE)
+    use_source(o, &args[0]);
+  else if (e->op == JUMPIF || e->op == JUMPNIF)
+    use_source(o, &args[1]);
+  for (i = 1; i <= n; i++)
+    use_source(o, &args[i]);
+  if (args[0].type == ADDRESS && e->op != WRITE && e->op != HALT)
+    use_address(o, &args[0]);
+
+  //writes
+  if (e->op == WRITE || e->op == HALT || e->op == JUMP
+      || e->op == JUMPIF || e->op == JUMPNIF)
+    return;
+
+  if (args[0].type == REGISTER && e->op != READB && e->op != READI) {
+    d = args[0].reg;
+    if (e->op == MOVE && args[1].type == REGISTER && args[1].reg == d) {
+      remove_slot(o, pc);
+      return;
+    }
+    if (o->def[d] >= 0)
+      remove_slot(o, o->def[d]);
+
+    o->copy[d] = -1;
+    for (i = 0; i < MAX_REGISTERS; i++)
+      if (o->copy[i] == d)
+        o->copy[i] = -1;
+
+    o->known[d] = e->op == IDM;
+    o->value[d] = args[1].number;
+    if (e->op == MOVE && args[1].type == REGISTER)
+      o->copy[d] = args[1].reg;
+
+    //only writes that cannot fault may be removed
+    o->def[d] = -1;
+    if (e->op != LOAD && e->op != DIV && (n < 1 || args[1].type == REGISTER)
+        && (n < 2 || args[2].type == REGISTER))
+      o->def[d] = pc;
+  } else if (constant_target(&args[0], &addr) && addr >= 0 && addr < STACK_SIZE) {
+    if (o->store[addr] >= 0)
+      remove_slot(o, o->store[addr]);
+    o->store[addr] = -1;
+    if ((e->op == IDM || e->op == STORE) && addr >= o->m->slots_used)
+      o->store[addr] = pc;
+  }
+}
+
+/*
+  Optimizes m's program in place and returns the number of
+  instructions removed.
+ */
+int optimize_program(struct ami_machine *m) {
+  struct optimizer *o;
+  unsigned int pc, b;
+  int target, removed;
+
+  for (pc = 0; pc < m->slots_used; pc++) {
+    int op = m->mem[pc].op;
+    if ((op == JUMP || op == JUMPIF || op == JUMPNIF)
+        && !constant_target(&m->mem[pc].arguments[0], &target))
+      return 0;
+  }
+
+  o = malloc(sizeof(struct optimizer));
+  if (!o)
+    return 0;
+  o->m = m;
+  o->removed = 0;
+  memset(o->written, 0, sizeof(o->written));
+  for (pc = 0; pc < m->slots_used; pc++) {
+    struct stack_entry *e = &m->mem[pc];
+    if (e->op != HALT && e->op != WRITE && e->op != JUMP && e->op != JUMPIF
+        && e->op != JUMPNIF && e->arguments[0].type == REGISTER)
+      o->written[e->arguments[0].reg] = 1;
+  }
+
+  //blocks are only read here; they are rebuilt from the result
+  build_blocks(m);
+  for (b = 0; b < m->block_count; b++) {
+    forget(o);
+    for (pc = m->blocks[b].start; pc < m->blocks[b].end; pc++)
+      if (m->mem[pc].op != NOP)
+        optimize_instruction(o, pc);
+  }
+
+  removed = o->removed;
+  free(o);
+  return removed;
+}
@@ -0,0 +1,128 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Counter benchmark mode (-b N -C).  Runs the program N times with
+  perf_event counters sampling host cycles, instructions, branch
+  misses and cache misses, and charges each sample to the opcode of
+  the AMI instruction being run when the counter overflowed.  Dividing
+  by the number of times each opcode was executed (from the block
+  entry counts, which cost the engine nothing extra) gives the host
+  cost per simulated instruction of each opcode handler.
+
+  Sampling rather than reading the counters around every instruction
+  keeps the measurement from swamping what it measures.  Where the
+  PMU is not available, as in most virtual machines, the software
+  task clock takes the place of cycles and the other columns are
+  left out.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <linux/perf_event.h>
+
+#include "sim.h"
+#include "sampler.h"
+
+#define COUNTER_SAMPLES (1 << 22)
+
+struct counter {
+  char *heading;
+  unsigned int type;
+  unsigned long config, period;
+  int source;//from sampler_counter(), -1 if unavailable
+};
+
+static struct counter counters[] = {
+  { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 100003, -1 },
+  { "instrs", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 100003, -1 },
+  { "br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, 1009, -1 },
+  { "llc-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, 1009, -1 },
+  { "ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, 100003, -1 },
+};
+#define COUNTERS (sizeof(counters) / sizeof(counters[0]))
+#define TASK_CLOCK (COUNTERS - 1)
+
+/*
+  Adds the instructions run since the last reset, by opcode
+ */
+static void count_executed(struct ami_machine *m, unsigned long *executed) {
+  unsigned int b, pc;
+
+  for (b = 0; b < m->block_count; b++)
+    for (pc = m->blocks[b].start; pc < m->blocks[b].end; pc++)
+      executed[m->mem[pc].op] += m->blocks[b].entries;
+}
+
+void run_counters(struct ami_machine *m, int reps) {
+  unsigned long executed[ILLEGAL + 1] = { 0 }, events[ILLEGAL + 1][COUNTERS];
+  unsigned long n, dropped, i;
+  struct sample *samples;
+  int c, op, opened = 0, saved_errno = 0;
+
+  if (sampler_start(&m->PC, &m->running, 0, COUNTER_SAMPLES) < 0) {
+    printf("out of memory\n");
+    return;
+  }
+  for (c = 0; c < TASK_CLOCK; c++) {
+    counters[c].source = sampler_counter(counters[c].type, counters[c].config,
+                                         counters[c].period);
+    if (counters[c].source < 0)
+      saved_errno = errno;
+    else
+      opened++;
+  }
+  if (counters[0].source < 0) {
+    printf("hardware counters unavailable (%s), using the task clock\n", strerror(saved_errno));
+    counters[TASK_CLOCK].source = sampler_counter(counters[TASK_CLOCK].type,
+                                                  counters[TASK_CLOCK].config,
+                                                  counters[TASK_CLOCK].period);
+    if (counters[TASK_CLOCK].source < 0) {
+      printf("perf_event_open failed: %s\n", strerror(errno));
+      sampler_stop();
+      return;
+    }
+  }
+
+  for (i = 0; i < reps; i++) {
+    reset_machine(m);
+    rewind(stdin);
+    run(m, 0);
+    count_executed(m, executed);
+  }
+
+  sampler_stop();
+  samples = sampler_samples(&n, &dropped);
+
+  memset(events, 0, sizeof(events));
+  for (i = 0; i < n; i++) {
+    struct sample *s = &samples[i];
+    if (!s->running || s->pc >= m->slots_used)
+      continue;
+    for (c = 0; c < COUNTERS; c++)
+      if (counters[c].source == s->source)
+        events[m->mem[s->pc].op][c] += counters[c].period;
+  }
+
+  printf("%s: %d runs, %lu samples", m->filename, reps, n);
+  if (dropped)
+    printf(" (%lu dropped)", dropped);
+  printf("\n\nopcode      executed");
+  for (c = 0; c < COUNTERS; c++)
+    if (counters[c].source >= 0)
+      printf("  %8s/inst", counters[c].heading);
+  printf("\n");
+
+  for (op = 0; op <= ILLEGAL; op++) {
+    if (!executed[op])
+      continue;
+    printf("%-8s %11lu", opcode_name(op), executed[op]);
+    for (c = 0; c < COUNTERS; c++)
+      if (counters[c].source >= 0)
+        printf("  %13.2f", (double)events[op][c] / executed[op]);
+    printf("\n");
+  }
+}
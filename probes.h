@@ -0,0 +1,37 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Static tracepoints (USDT) for bpftrace and other tools, in the
+  provider 'ami'.  Built with -DENABLE_USDT ('make usdt', needs
+  <sys/sdt.h> from systemtap-sdt-dev) each probe is a single nop
+  until a tracer attaches; otherwise they compile to nothing.
+
+    dispatch(pc, op)              before each instruction is run
+    mem_read(addr, value)         data memory read by an instruction
+    mem_write(addr, value)        data memory written by an instruction
+    fault(pc, message)            raise() is about to exit
+    load_start(filename)          allocate_stack() begins
+    load_done(filename, slots)    allocate_stack() has decoded the program
+    gui_update_start(pc)          update_gui() begins
+    gui_update_done(pc)           update_gui() has sent everything
+    gui_send_start(length)        one buffer is handed to the GUI
+    gui_send_done(length)         the GUI has taken it
+
+  See bpftrace/ for example scripts.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#ifdef ENABLE_USDT
+#include <sys/sdt.h>
+#define PROBE1(name, a) DTRACE_PROBE1(ami, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(ami, name, a, b)
+#else
+#define PROBE1(name, a) do { } while (0)
+#define PROBE2(name, a, b) do { } while (0)
+#endif
+
+#endif // PROBES_H
@@ -0,0 +1,117 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Sampling profiler for the simulator itself (-P FILE).  About a
+  thousand times per second of CPU time the interval timer notes the
+  host function that was running and, when the engine was running,
+  the AMI PC.  At exit the samples are written to FILE as folded
+  stacks for flamegraph.pl:
+
+    add;pc 7;arg_get_value 412
+
+  that is AMI opcode, PC and host function, or '[not running]' and
+  the host function for time spent outside the engine.  Host
+  functions are named from the dynamic symbol table (the build links
+  with -rdynamic), so static functions that were not inlined show up
+  under the exported function before them.
+ */
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+#include "sim.h"
+#include "sampler.h"
+
+#define PROFILE_HZ 997//prime, so samples do not beat with periodic work
+#define PROFILE_SAMPLES (1 << 20)
+
+static struct ami_machine *profiled;
+static char *profile_file;
+static pid_t profile_pid;
+
+static const char *host_function(void *ip) {
+  Dl_info info;
+  const char *slash;
+
+  if (!ip || !dladdr(ip, &info))
+    return "[unknown]";
+  if (info.dli_sname)
+    return info.dli_sname;
+  if (info.dli_fname) {
+    slash = strrchr(info.dli_fname, '/');
+    return slash ? slash + 1 : info.dli_fname;
+  }
+  return "[unknown]";
+}
+
+static int compare_keys(const void *a, const void *b) {
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void profile_write(void) {
+  struct ami_machine *m = profiled;
+  struct arena keys_arena = { 0 };
+  struct sample *samples;
+  unsigned long n, dropped, i, run;
+  char **keys;
+  FILE *out;
+
+  //children forked by 'explore' share the handler
+  if (getpid() != profile_pid)
+    return;
+  sampler_stop();
+  samples = sampler_samples(&n, &dropped);
+
+  keys = malloc((n + 1) * sizeof(char *));
+  out = fopen(profile_file, "w");
+  if (!keys || !out) {
+    perror("Cannot write profile");
+    return;
+  }
+
+  for (i = 0; i < n; i++) {
+    struct sample *s = &samples[i];
+    if (s->running && s->pc < m->slots_used)
+      keys[i] = arena_printf(&keys_arena, "%s;pc %u;%s", opcode_name(m->mem[s->pc].op),
+                             s->pc, host_function(s->ip));
+    else
+      keys[i] = arena_printf(&keys_arena, "[not running];%s", host_function(s->ip));
+  }
+  qsort(keys, n, sizeof(char *), compare_keys);
+
+  for (i = 0; i < n; i += run) {
+    for (run = 1; i + run < n && !strcmp(keys[i], keys[i + run]); run++)
+      ;
+    fprintf(out, "%s %lu\n", keys[i], run);
+  }
+  fclose(out);
+
+  fprintf(stderr, "profile: %lu samples", n);
+  if (dropped)
+    fprintf(stderr, " (%lu more dropped)", dropped);
+  fprintf(stderr, " written to %s\n", profile_file);
+
+  free(keys);
+  arena_free(&keys_arena);
+}
+
+/*
+  Samples m until the simulator exits, then writes the folded stacks
+  to filename
+ */
+void profile_start(struct ami_machine *m, char *filename) {
+  if (sampler_start(&m->PC, &m->running, PROFILE_HZ, PROFILE_SAMPLES) < 0) {
+    perror("Cannot start profiler");
+    return;
+  }
+  profiled = m;
+  profile_file = filename;
+  profile_pid = getpid();
+  atexit(profile_write);
+}
@@ -12,33 +12,38 @@
 unsigned short gethalf(void *p) { return *(unsigned short *)p; }
 unsigned int getfull(void *p) { return *(unsigned int *)p; }
 
-char *readfile(char *filename)
+/*
+  Reads the whole file into memory from a, NUL-terminated.  Returns
+  NULL, with the reason printed, if it cannot be read or is empty.
+ */
+char *readfile(char *filename, struct arena *a)
 {
   struct stat fileinfo;
   if (stat(filename, &fileinfo) < 0) {
-    perror("Cannot open file"); exit(1);
+    perror("Cannot open file"); return NULL;
   }
 
   int filesize = (int)fileinfo.st_size;
 #ifdef READELF_DEBUG
   printf("File size is: %d\n", filesize);
 #endif
+  if (filesize == 0) {
+    printf("Cannot read file: %s is empty\n", filename); return NULL;
+  }
 
   FILE *fd = fopen(filename, "r");
   if (!fd) {
-    perror("Cannot open file"); exit(1);
+    perror("Cannot open file"); return NULL;
   }
 
-  char* buf = malloc(filesize);
-  if (!buf) {
-    perror("malloc failed"); exit(1);
-  }
+  char* buf = arena_alloc(a, filesize + 1);
 
   if (fread(buf, 1, filesize, fd) <= 0) {
-    perror("Cannot read file"); exit(1);
+    perror("Cannot read file"); fclose(fd); return NULL;
   }
 
   fclose(fd);
+  buf[filesize] = '\0';
 
   return buf;
 }
@@ -0,0 +1,237 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Reloading an edited program in the middle of a session.  The new
+  file is compared with the loaded program line by line from both
+  ends; only the lines between the common prefix and suffix are
+  decoded.  Registers and data memory are kept, and the PC and
+  breakpoints are moved along with the lines they were on.
+
+  Data lives at fixed addresses after the program, so a reload that
+  grows the program gives the slots it now covers to instructions and
+  one that shrinks it hands slots back as data.
+
+  With 'autoreload on', inotify watches the directory holding the
+  file (editors often replace a file rather than write it) and the
+  debugger reloads before running the next command after a change.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/inotify.h>
+
+#include "sim.h"
+
+struct source_line {
+  char *text;
+  unsigned int line;
+};
+
+/*
+  Moves an address in the old program to the new one, where the old
+  slots [prefix, old_n - suffix) were replaced by changed new ones.
+  Returns -1 for slots past the end of the replacement.
+ */
+static int remap(unsigned int addr, unsigned int prefix, unsigned int suffix,
+                 unsigned int old_n, unsigned int new_n, unsigned int changed) {
+  if (addr < prefix || addr >= old_n)
+    return addr;
+  if (addr >= old_n - suffix)
+    return addr + new_n - old_n;
+  return addr - prefix < changed ? (int)addr : -1;
+}
+
+int reload_program(struct ami_machine *m) {
+  unsigned int old_n = m->slots_used, new_n = 0, p, s, i, changed, source_line = 0;
+  struct source_line *lines;
+  struct stack_entry *fresh;
+  struct breakpoint *bp, *next;
+  struct arena swap;
+  char *file, *line, *end, *error;
+  int errors = 0, reg_count = m->reg_count, addr;
+
+  if (access(m->filename, R_OK)) {
+    perror("Cannot reload");
+    return -1;
+  }
+
+  //the new text goes in the spare arena until it replaces the old
+  arena_reset(&m->spare);
+  file = readfile(m->filename, &m->spare);
+  if (!file) {
+    printf("Program not reloaded\n");
+    return -1;
+  }
+  lines = arena_alloc(&m->spare, STACK_SIZE * sizeof(struct source_line));
+
+  for (line = file; *line; line = end) {
+    end = strchr(line, '\n');
+    if (end)
+      *end++ = '\0';
+    else
+      end = line + strlen(line);
+    source_line++;
+    if (*line == '\0')
+      continue;
+    if (new_n == STACK_SIZE) {
+      printf("Program does not fit in %d memory slots, not reloaded\n", STACK_SIZE);
+      return -1;
+    }
+    lines[new_n].text = line;
+    lines[new_n].line = source_line;
+    new_n++;
+  }
+
+  for (p = 0; p < old_n && p < new_n && !strcmp(m->mem[p].instruction, lines[p].text); p++)
+    ;
+  for (s = 0; s < old_n - p && s < new_n - p
+         && !strcmp(m->mem[old_n - 1 - s].instruction, lines[new_n - 1 - s].text); s++)
+    ;
+  changed = new_n - p - s;
+
+  //decode and check the new lines before touching the machine
+  fresh = arena_alloc(&m->spare, changed * sizeof(struct stack_entry));
+  m->slots_used = new_n;
+  for (i = 0; i < changed; i++) {
+    fresh[i].instruction = lines[p + i].text;
+    fresh[i].line = lines[p + i].line;
+    decode_instr(fresh[i].instruction, &fresh[i], &reg_count);
+    if ((error = instruction_error(m, &fresh[i]))) {
+      printf("%s:%u: %s\n    %s\n", m->filename, fresh[i].line, error, fresh[i].instruction);
+      errors++;
+    }
+  }
+
+  //jumps that were kept must still land inside the program
+  for (i = 0; i < old_n; i++) {
+    struct stack_entry *e = &m->mem[i];
+    int op = e->op, kept = i < p || i >= old_n - s;
+    if (!kept || (m->opt_lazy && m->block_of[i] == NO_BLOCK))
+      continue;
+    if ((op == JUMP || op == JUMPIF || op == JUMPNIF) && (error = instruction_error(m, e))) {
+      printf("%s:%u: %s\n    %s\n", m->filename,
+             lines[i < p ? i : i + new_n - old_n].line, error, e->instruction);
+      errors++;
+    }
+  }
+
+  if (errors && !m->opt_noverify) {
+    m->slots_used = old_n;
+    printf("%d bad instruction%s, program not reloaded\n", errors, errors == 1 ? "" : "s");
+    return -1;
+  }
+
+  memmove(&m->mem[new_n - s], &m->mem[old_n - s], s * sizeof(struct stack_entry));
+  memcpy(&m->mem[p], fresh, changed * sizeof(struct stack_entry));
+  for (i = 0; i < new_n; i++) {
+    m->mem[i].instruction = lines[i].text;
+    m->mem[i].line = lines[i].line;
+    m->mem[i].data_type = INSTRUCTION;
+  }
+  for (i = new_n; i < old_n; i++) {
+    m->mem[i].data_type = DATA;
+    m->mem[i].data = 0;
+  }
+
+  swap = m->program;
+  m->program = m->spare;
+  m->spare = swap;
+
+  m->reg_count = reg_count;
+  m->verified = errors == 0;
+  if (m->opt_lazy) {
+    forget_blocks(m);
+  } else {
+    //the optimizer rewrote the kept slots for their old neighbours
+    if (m->opt_optimize) {
+      decode_program(m);
+      if (m->verified)
+        optimize_program(m);
+    }
+    build_blocks(m);
+  }
+
+  //breakpoints and the PC follow their lines
+  for (bp = m->breakpoints; bp != NULL; bp = next) {
+    next = bp->next;
+    if ((addr = remap(bp->addr, p, s, old_n, new_n, changed)) < 0)
+      del_breakpoint(m, bp->id);
+    else
+      bp->addr = addr;
+  }
+  mark_breakpoint_blocks(m);
+  unskip_breakpoints(m);
+
+  if ((addr = remap(m->PC, p, s, old_n, new_n, changed)) < 0) {
+    printf("the PC was on a deleted line and is now at %u\n", p);
+    addr = p;
+  }
+  m->PC = addr;
+  m->nPC = m->PC;
+
+  //replaying history recorded under the old program would diverge
+  history_reset(m);
+  select_engine(m);
+
+  printf("reloaded %s: %u instruction%s replaced by %u at address %u\n", m->filename,
+         old_n - p - s, old_n - p - s == 1 ? "" : "s", changed, p);
+  return 0;
+}
+
+int set_autoreload(struct ami_machine *m, int on) {
+  char *dir;
+
+  if (m->autoreload_fd > 0) {
+    close(m->autoreload_fd);
+    m->autoreload_fd = 0;
+  }
+  if (!on)
+    return 0;
+
+  m->autoreload_fd = inotify_init1(IN_NONBLOCK);
+  if (m->autoreload_fd < 0) {
+    perror("Cannot watch program file");
+    m->autoreload_fd = 0;
+    return -1;
+  }
+
+  dir = strdup(m->filename);
+  if (inotify_add_watch(m->autoreload_fd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    perror("Cannot watch program file");
+    close(m->autoreload_fd);
+    m->autoreload_fd = 0;
+  }
+  free(dir);
+  return m->autoreload_fd ? 0 : -1;
+}
+
+/*
+  Reloads the program if inotify reported that it was written or
+  replaced since the last check
+ */
+void check_autoreload(struct ami_machine *m) {
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  char *name = strdup(m->filename), *base = basename(name), *p;
+  struct inotify_event *ev;
+  ssize_t len;
+  int changed = 0;
+
+  while ((len = read(m->autoreload_fd, buf, sizeof(buf))) > 0) {
+    for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+      ev = (struct inotify_event *)p;
+      if (ev->len && !strcmp(ev->name, base))
+        changed = 1;
+    }
+  }
+  free(name);
+
+  if (changed) {
+    printf("%s changed on disk\n", m->filename);
+    reload_program(m);
+  }
+}
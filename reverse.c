@@ -0,0 +1,286 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Reverse execution.  While the program runs, a snapshot of the
+  registers, PC and data memory is taken every 'interval'
+  instructions, and every value read by READI/READB is appended to
+  an I/O log.  Going backwards restores the nearest earlier snapshot
+  and replays forward from it, feeding reads from the log, so the
+  replayed run is identical to the original one.
+
+  At most MAX_CHECKPOINTS snapshots are kept.  When the table fills
+  up, every other snapshot is dropped and the interval doubles, so
+  memory stays bounded and a reverse step never replays more than
+  two intervals worth of instructions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "sim.h"
+
+struct history *history_create(void) {
+  struct history *h = calloc(sizeof(struct history), 1);
+  if (h)
+    h->interval = CHECKPOINT_INTERVAL;
+  return h;
+}
+
+/*
+  Forgets all checkpoints and logged input, e.g. on reset.  The
+  first checkpoint is taken before the next instruction executes.
+ */
+void history_reset(struct ami_machine *m) {
+  struct history *h = m->history;
+
+  m->icount = 0;
+  if (!h) {
+    m->next_checkpoint = ULONG_MAX;
+    return;
+  }
+
+  h->count = 0;
+  h->interval = CHECKPOINT_INTERVAL;
+  h->io_count = 0;
+  h->io_pos = 0;
+  m->next_checkpoint = 0;
+}
+
+static void save_state(struct ami_machine *m, struct checkpoint *c) {
+  int i;
+  c->icount = m->icount;
+  c->PC = m->PC;
+  c->halted = m->halted;
+  memcpy(c->R, m->R, sizeof(c->R));
+  for (i = 0; i < STACK_SIZE; i++)
+    c->data[i] = m->mem[i].data;
+}
+
+static void restore_state(struct ami_machine *m, struct checkpoint *c) {
+  int i;
+  m->icount = c->icount;
+  m->PC = m->nPC = c->PC;
+  m->halted = c->halted;
+  memcpy(m->R, c->R, sizeof(m->R));
+  for (i = 0; i < STACK_SIZE; i++)
+    m->mem[i].data = c->data[i];
+}
+
+void take_checkpoint(struct ami_machine *m) {
+  struct history *h = m->history;
+  int i;
+
+  if (h->count == MAX_CHECKPOINTS) {
+    //keep checkpoints 0, 2, 4, ... and space the rest out twice as far
+    for (i = 0; i < MAX_CHECKPOINTS / 2; i++)
+      h->cp[i] = h->cp[2 * i];
+    h->count = MAX_CHECKPOINTS / 2;
+    h->interval *= 2;
+  }
+
+  if (h->count == 0 || h->cp[h->count - 1].icount < m->icount)
+    save_state(m, &h->cp[h->count++]);
+
+  m->next_checkpoint = h->cp[h->count - 1].icount + h->interval;
+}
+
+int io_log_replay(struct ami_machine *m, int *value) {
+  struct history *h = m->history;
+
+  if (!h || h->io_pos >= h->io_count || h->io[h->io_pos].icount != m->icount)
+    return 0;
+
+  *value = h->io[h->io_pos++].value;
+  return 1;
+}
+
+void io_log_append(struct ami_machine *m, int value) {
+  struct history *h = m->history;
+
+  if (!h)
+    return;
+
+  if (h->io_count == h->io_capacity) {
+    unsigned long capacity = h->io_capacity ? 2 * h->io_capacity : 64;
+    struct io_event *io = realloc(h->io, capacity * sizeof(struct io_event));
+    if (!io) {
+      printf("out of memory, input will not be replayed\n");
+      return;
+    }
+    h->io = io;
+    h->io_capacity = capacity;
+  }
+
+  //anything logged past this point belonged to a discarded future
+  h->io_count = h->io_pos;
+  h->io[h->io_count].icount = m->icount;
+  h->io[h->io_count].value = value;
+  h->io_count++;
+  h->io_pos = h->io_count;
+}
+
+/*
+  Makes value the input read by the instruction at m->icount, in
+  place of asking for one
+ */
+void io_log_insert(struct ami_machine *m, int value) {
+  io_log_append(m, value);
+  if (m->history)
+    m->history->io_pos--;
+}
+
+/*
+  Executes instructions silently on the plain engine until m->icount
+  reaches target, without stopping at breakpoints or watchpoints or
+  recording trace records.  Returns -1, with a message, if the run
+  stops short of target.
+ */
+static int replay(struct ami_machine *m, unsigned long target) {
+  struct breakpoint *breakpoints = m->breakpoints;
+  int hooks = m->hooks;
+  int quiet = m->opt_quiet;
+  int ret = -RUN_OK;
+
+  m->breakpoints = NULL;
+  m->hooks = 0;
+  m->opt_quiet = 1;
+
+  while (m->icount < target && ret == -RUN_OK) {
+    unsigned long left = target - m->icount;
+    ret = _run(m, left > INT_MAX ? INT_MAX : (int)left);
+  }
+
+  m->breakpoints = breakpoints;
+  m->hooks = hooks;
+  m->opt_quiet = quiet;
+
+  if (ret != -RUN_OK) {
+    printf("replay stopped at instruction %lu instead of %lu\n", m->icount, target);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+  Moves the machine to the state it had after target instructions,
+  or to the oldest checkpoint if target is older than that.  Returns
+  -1 if the replay from the checkpoint stopped short.
+ */
+static int travel_to(struct ami_machine *m, unsigned long target) {
+  struct history *h = m->history;
+  int lo = 0, hi = h->count - 1, ret;
+
+  //cp[0] is the oldest state kept: icount 0, or where a snapshot was restored
+  if (target < h->cp[0].icount)
+    target = h->cp[0].icount;
+
+  //latest checkpoint at or before target
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (h->cp[mid].icount <= target) lo = mid;
+    else hi = mid - 1;
+  }
+  restore_state(m, &h->cp[lo]);
+
+  //rewind the I/O log cursor to the first read at or after icount
+  h->io_pos = 0;
+  while (h->io_pos < h->io_count && h->io[h->io_pos].icount < m->icount)
+    h->io_pos++;
+
+  ret = replay(m, target);
+  m->next_checkpoint = h->cp[h->count - 1].icount + h->interval;
+  return ret;
+}
+
+/*
+  Trace records past the new position describe instructions that
+  have been undone; drop them so 'info trace' ends at the PC.
+ */
+static void rewind_trace(struct ami_machine *m, unsigned long undone) {
+  struct trace_buffer *t = m->trace;
+  if (t)
+    t->head -= undone < t->head ? undone : t->head;
+}
+
+int reverse_step(struct ami_machine *m, unsigned long steps) {
+  unsigned long from = m->icount, first;
+
+  if (!m->history || m->history->count == 0) {
+    printf("no execution history recorded\n");
+    return -1;
+  }
+  first = m->history->cp[0].icount;
+  if (from <= first) {
+    printf("already at the beginning of the recorded history\n");
+    return -1;
+  }
+
+  if (travel_to(m, steps < from - first ? from - steps : first) < 0)
+    return -1;
+  rewind_trace(m, from - m->icount);
+  unskip_breakpoints(m);
+  skip_breakpoint(m);
+  return 0;
+}
+
+/*
+  Whether a breakpoint at the PC would stop the program, like
+  is_breakpoint() but without consuming a skip
+ */
+static int breakpoint_hit(struct ami_machine *m) {
+  struct breakpoint *b = m->breakpoints;
+  while (b != NULL && b->addr != m->PC)
+    b = b->next;
+  return b && (!b->cond || cond_eval(m, b->cond));
+}
+
+int reverse_continue(struct ami_machine *m) {
+  struct history *h = m->history;
+  unsigned long from = m->icount, hit = ULONG_MAX;
+  int i;
+
+  if (!h || h->count == 0) {
+    printf("no execution history recorded\n");
+    return -1;
+  }
+  if (from <= h->cp[0].icount) {
+    printf("already at the beginning of the recorded history\n");
+    return -1;
+  }
+
+  //search the history one checkpoint interval at a time, newest first
+  for (i = h->count - 1; i >= 0 && hit == ULONG_MAX; i--) {
+    unsigned long end;
+    if (h->cp[i].icount >= from)
+      continue;
+    end = (i + 1 < h->count && h->cp[i + 1].icount < from) ? h->cp[i + 1].icount : from;
+
+    if (travel_to(m, h->cp[i].icount) < 0)
+      return -1;
+    while (m->icount < end && !m->halted) {
+      if (breakpoint_hit(m))
+        hit = m->icount;
+      if (replay(m, m->icount + 1) < 0)
+        return -1;
+    }
+  }
+
+  if (hit == ULONG_MAX) {
+    if (travel_to(m, h->cp[0].icount) < 0)
+      return -1;
+    printf("no breakpoint reached, stopped at the beginning of the recorded history\n");
+  } else {
+    if (travel_to(m, hit) < 0)
+      return -1;
+    printf("breakpoint %d reached at address %d\n", find_breakpoint(m, m->PC), m->PC);
+  }
+
+  rewind_trace(m, from - m->icount);
+  unskip_breakpoints(m);
+  skip_breakpoint(m);
+  return 0;
+}
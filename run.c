@@ -10,533 +10,197 @@
 #include <time.h>
 
 #include "sim.h"
+#include "probes.h"
 
 jmp_buf err_handler;
 
+//per-instruction text output, off in GUI mode and while replaying
+#define TEXT_OUTPUT(m) (!(m)->opt_graphical && !(m)->opt_quiet)
+
 void raise(struct ami_machine *m, char *msg)
 {
     char *inst = m->mem[m->PC].instruction;
+
+    PROBE2(fault, m->PC, msg);
     if (inst) {
         printf("AMI processor choked on instruction %s with message: %s\n", inst, msg);
     } else {
         printf("AMI processor choked at illegal pc %d with message: %s\n", m->PC, msg);
     }
 
+    if (m->trace) {
+        printf("Last instructions executed:\n");
+        trace_print(m->trace, stdout, TRACE_FAULT_RECORDS);
+    }
+
     if (m->opt_graphical) {
         *(m->shm + 2) = '\0';
         *(m->shm + 1) = 'q';
         *(m->shm) = 'r';
     }
+    if (m->escape)
+        longjmp(*m->escape, RUN_FAULT);
     exit(1);
 }
 
-int _run(struct ami_machine* m, int count)
+/*
+  Appends the instruction just executed at pc to the trace ring,
+  along with the register, memory slot or jump target it wrote.
+ */
+static inline void trace_instruction(struct ami_machine *m, unsigned int pc,
+                                     struct stack_entry *entry)
 {
-    int op, addr1, addr2;
-    char str[20];
-    struct stack_entry entry;
-    for (;;) {
-        if (m->halted)
-            return -RUN_HALTED;
-
-        if (is_breakpoint(m, m->PC)) {
-            return -RUN_BREAKPOINT;
+    struct trace_buffer *t = m->trace;
+    struct trace_record *r = &t->records[t->head++ & t->mask];
+
+    r->pc = pc;
+    r->op = entry->op;
+
+    switch (entry->op) {
+    case HALT:
+    case WRITE:
+    case NOP:
+        r->kind = TRACE_NONE;
+        break;
+    case JUMP:
+    case JUMPIF:
+    case JUMPNIF:
+        r->kind = TRACE_JUMP;
+        r->dest = m->nPC;
+        break;
+    default:
+        if (entry->arguments[0].type == REGISTER) {
+            r->kind = TRACE_REG;
+            r->dest = entry->arguments[0].reg;
+            r->value = m->R[r->dest];
+        } else {
+            r->kind = TRACE_MEM;
+            r->dest = mem_get_addr(m, entry->arguments[0]);
+            r->value = m->mem[r->dest].data;
         }
+    }
+}
 
-        m->nPC = m->PC + 1;
+/*
+  Fetches the next console input.  Inputs already recorded in the
+  I/O log for this point in the run are replayed from it; otherwise
+  the value comes from the GUI or stdin and is appended to the log.
+ */
+static int console_input(struct ami_machine *m)
+{
+    char str[20];
+    int value;
 
-        op = m->mem[m->PC].op;
-        entry = m->mem[m->PC];
+    //what follows depends on more than the state the loop detector saw
+    if (m->loops)
+        loop_reset(m);
 
-        if (!m->opt_graphical) {
-            printf("%s\n", entry.instruction);
-        }
+    if (io_log_replay(m, &value))
+        return value;
 
-        switch(op) {
-        case HALT:
-            if (!m->opt_graphical) {
-                printf("HALT\n");
-            }
-            m->halted = 1;
-            break;
-        case WRITE:
-            if (m->opt_graphical) {
-                m->console_io_value  = arg_get_value(m, entry.arguments[0]);
-                m->console_io_status = 2;
-            } else {
-                printf("WRITE -> %i\n", arg_get_value(m, entry.arguments[0]));
-            }
-            break;
-        case READB:
-            if (entry.argc == 1) {
-                addr1 = mem_get_addr(m, entry.arguments[0]);
-                if (m->opt_graphical) {
-                    //send input prompt
-                    //wait for input
-                    m->console_io_status = 1;
-                    update_gui(m);
-                    mem_write(m, addr1, m->console_io_value != 0);
-                } else {
-                    fgets(str, 20, stdin);
-                    mem_write(m, addr1, atoi(str) != 0);
-                    printf("READB, mem[%i] <- %i\n", addr1, atoi(str) != 0);
-                }
-            } else {
-                raise(m, "Non address destination for READB");
-            }
-            break;
-        case READI:
-            if (entry.argc == 1) {
-                addr1 = mem_get_addr(m, entry.arguments[0]);
-                if (m->opt_graphical) {
-                    //send input prompt
-                    //wait for input
-                    m->console_io_status = 1;
-                    update_gui(m);
-                    mem_write(m, addr1, m->console_io_value);
-                } else {
-                    fgets(str, 20, stdin);
-                    mem_write(m, addr1, atoi(str));
-                    printf("READI, mem[%i] <- %i\n", addr1, m->mem[addr1].data);
-                }
-            } else {
-                raise(m, "Non address destination for READI");
-            }
-            break;
-        case JUMP:
-            addr1 = add_get_value(m, entry.arguments[0]);
-            if (addr1 < m->slots_used) {
-                m->nPC = addr1;
-                if (!m->opt_graphical) {
-                    printf("JUMP to %i\n", addr1);
-                }
-            } else {
-                raise(m, "Attempted to jump past instructions in stack");
-            }
-            break;
-        case JUMPIF:
-            addr1 = add_get_value(m, entry.arguments[0]);
-            if (arg_get_value(m, entry.arguments[1])) {
-                m->nPC = addr1;
-                if (!m->opt_graphical) {
-                    printf("JUMPIF to %i, COND TRUE\n", addr1);
-                }
-            } else {
-                if (!m->opt_graphical) {
-                    printf("JUMPIF to %i, COND FALSE\n", addr1);
-                }
-            }
-            break;
-        case JUMPNIF:
-            addr1 = add_get_value(m, entry.arguments[0]);
-            if (arg_get_value(m, entry.arguments[1]) == 0) {
-                m->nPC = addr1;
-                if (!m->opt_graphical) {
-                    printf("JUMPNIF to %i, COND TRUE\n", addr1);
-                }
-            } else {
-                if (!m->opt_graphical) {
-                printf("JUMPNIF to %i, COND FALSE\n", addr1);
-                }
-            }
-            break;
-        case MOVE:
-            if (entry.arguments[0].type == REGISTER) {
-                m->R[entry.arguments[0].reg] = arg_get_value(m, entry.arguments[1]);
-                if (!m->opt_graphical) {
-                    printf("MOVE, r%i <- %i\n", 
-                           entry.arguments[0].reg, arg_get_value(m, entry.arguments[1]));
-                }
-            } else if (entry.arguments[0].type == ADDRESS) {
-                addr1 = mem_get_addr(m, entry.arguments[0]);
-                mem_write(m, addr1,  arg_get_value(m, entry.arguments[1]));
-                if (!m->opt_graphical) {
-                    printf("MOVE, mem[%i] <- %i\n",
-                           addr1, arg_get_value(m, entry.arguments[1]));
-                }
-            } else {
-                raise(m, "Inappropriate destination for move");
-            }
-            break;
-        case LOAD:
-            if (entry.argc == 2) {
-                addr1 = mem_get_addr(m, entry.arguments[1]);
-                m->R[entry.arguments[0].reg] = mem_read(m, addr1);
-                if (!m->opt_graphical) {
-                    printf("LOAD, r%i <- %i\n", 
-                           entry.arguments[0].reg, mem_read(m, addr1));
-                }
-            } else {
-                raise(m, "Inappropriate destination for load");
-            }
-            break;
-        case STORE:
-            if (entry.argc == 2) {
-                addr1 = mem_get_addr(m, entry.arguments[0]);
-                mem_write(m, addr1, m->R[entry.arguments[1].reg]);
-                if (!m->opt_graphical) {
-                    printf("STORE, mem[%i] <- %i\n", 
-                           addr1, m->R[entry.arguments[1].reg]);
-                }
-            } else {
-                raise(m, "Inappropriate destination for store");
-            }
-            break;
-        case IDM:
-            if (entry.arguments[1].type == NUMBER) {
-                if (entry.arguments[0].type == REGISTER) {
-                    m->R[entry.arguments[0].reg] = entry.arguments[1].number;
-                    if (!m->opt_graphical) {
-                        printf("IDM, r%i <- %i\n", entry.arguments[0].reg, entry.arguments[1].number);
-                    }
-                } else if (entry.arguments[0].type == ADDRESS) {
-                    addr1 = mem_get_addr(m, entry.arguments[0]);
-                    mem_write(m, addr1, entry.arguments[1].number);
-                    if (!m->opt_graphical) {
-                        printf("IDM, mem[%i] <- %i\n", addr1, entry.arguments[1].number);
-                    }
-                } else {
-                    raise(m, "Inappropriate destination for immediate data move");
-                }
-            } else {
-                if (!m->opt_graphical) {
-                    printf("%i\n", entry.arguments[0].type);
-                }
-                raise(m, "Inappropriate number for immediate data move");
-            }
+    //a server session is asked for the value rather than blocking
+    if (m->escape)
+        longjmp(*m->escape, RUN_INPUT);
 
-            break;
-        case EQ:
-            if (entry.argc == 3) {
-                addr1 = entry.arguments[0].reg;
-                if (arg_get_value(m, entry.arguments[1]) ==
-                    arg_get_value(m, entry.arguments[2])) {
-                    m->R[addr1] = 1;
-                    if (!m->opt_graphical) {
-                        printf("EQ, r%i <- true\n", addr1);
-                    }
-                } else {
-                    m->R[addr1] = 0;
-                    if (!m->opt_graphical) {
-                        printf("EQ, r%i <- false\n", addr1);
-                    }
-                }
-            } else {
-                raise(m, "Non register argument in EQ instruction");
-            } 
-            break;
-        case NEQ:
-            if (entry.argc == 3) {
-                addr1 = entry.arguments[0].reg;
-                if (arg_get_value(m, entry.arguments[1]) ==
-                    arg_get_value(m, entry.arguments[2])) {
-                    m->R[addr1] = 1;
-                    if (!m->opt_graphical) {
-                        printf("NEQ, r%i <- false\n", addr1);
-                    }
-                } else {
-                    m->R[addr1] = 0;
-                    if (!m->opt_graphical) {
-                        printf("NEQ, r%i <- true\n", addr1);
-                    }
-                }
-            } else {
-                raise(m, "Non register argument in NEQ instruction");
-            }
-            break;
-        case LT:
-            if (entry.argc == 3) {
-                addr1 = entry.arguments[0].reg;
-                if (arg_get_value(m, entry.arguments[1]) <
-                    arg_get_value(m, entry.arguments[2])) {
-                    m->R[addr1] = 1;
-                    if (!m->opt_graphical) {
-                        printf("LT, r%i <- true\n", addr1);
-                    }
-                } else {
-                    m->R[addr1] = 0;
-                    if (!m->opt_graphical) {
-                        printf("LT, r%i <- false\n", addr1);
-                    }
-                }
-            } else {
-                raise(m, "Non register argument in LT instruction");
-            }
-            break;
-        case LTE:
-            if (entry.argc == 3) {
-                addr1 = entry.arguments[0].reg;
-                if (arg_get_value(m, entry.arguments[1]) <=
-                    arg_get_value(m, entry.arguments[2])) {
-                    m->R[addr1] = 1;
-                    if (!m->opt_graphical) {
-                        printf("LTE, r%i <- true\n", addr1);
-                    }
-                } else {
-                    m->R[addr1] = 0;
-                    if (!m->opt_graphical) {
-                        printf("LTE, r%i <- false\n", addr1);
-                    }
-                }
-            } else {
-                raise(m, "Non register argument in LTE instruction");
-            }
-            break;
-        case AND:
-            if (entry.argc == 3){
-                if (entry.arguments[0].type == REGISTER) {
-                    addr1 = entry.arguments[0].reg;
-                    if (arg_get_value(m, entry.arguments[1]) != 0
-                        && arg_get_value(m, entry.arguments[2]) != 0) {
-                        m->R[addr1] = 1;
-                        if (!m->opt_graphical) {
-                            printf("AND, r%i <- true\n", addr1);
-                        }
-                    } else {
-                        m->R[addr1] = 0;
-                        if (!m->opt_graphical) {
-                            printf("AND, r%i <- false\n", addr1);
-                        }
-                    } 
-                } else if (entry.arguments[0].type == ADDRESS) {
-                    addr1 = mem_get_addr(m, entry.arguments[0]);
-                    if (arg_get_value(m, entry.arguments[1]) != 0
-                        && arg_get_value(m, entry.arguments[2]) != 0) {
-                        mem_write(m, addr1, 1);
-                        if (!m->opt_graphical) {
-                            printf("AND, mem[%i] <- true\n", addr1);
-                        }
-                    } else {
-                        mem_write(m, addr1, 0);
-                        if (!m->opt_graphical) {
-                            printf("AND, mem[%i] <- false\n", addr1);
-                        }
-                    } 
-                } else {
-                    raise(m, "Inappropriate destination for AND");
-                }
-            } else { 
-                raise(m, "Wrong number of arguments for AND");
-            }
-            break;
-        case OR:
-            if (entry.argc == 3){
-                if (entry.arguments[0].type == REGISTER) {
-                    addr1 = entry.arguments[0].reg;
-                    if (arg_get_value(m, entry.arguments[1]) != 0
-                        || arg_get_value(m, entry.arguments[2]) != 0) {
-                        m->R[addr1] = 1;
-                        if (!m->opt_graphical) {
-                            printf("OR, r%i <- true\n", addr1);
-                        }
-                    } else {
-                        m->R[addr1] = 0;
-                        if (!m->opt_graphical) {
-                            printf("OR, r%i <- false\n", addr1);
-                        }
-                    }
-                } else if (entry.arguments[0].type == ADDRESS) {
-                    addr1 = mem_get_addr(m, entry.arguments[0]);
-                    if (arg_get_value(m, entry.arguments[1]) != 0
-                        || arg_get_value(m, entry.arguments[2]) != 0) {
-                        mem_write(m, addr1, 1);
-                        if (!m->opt_graphical) {
-                            printf("OR, mem[%i] <- true\n", addr1);
-                        }
-                    } else {
-                        mem_write(m, addr1, 0);
-                        if (!m->opt_graphical) {
-                            printf("OR, mem[%i] <- false\n", addr1);
-                        }
-                    }
-                } else {
-                    raise(m, "Inappropriate destination for OR");
-                }
-            } else { 
-                raise(m, "Wrong number of arguments for OR");
-            }
-            break;
-        case NOT:
-            if (entry.argc == 2) {
-                if (entry.arguments[0].type == REGISTER) {
-                    addr1 = entry.arguments[0].reg;
-                    if (arg_get_value(m, entry.arguments[1]) == 0) {
-                        m->R[addr1] = 1;
-                        if (!m->opt_graphical) {
-                            printf("NOT, r%i <- true\n", addr1);
-                        }
-                    } else {
-                        m->R[addr1] = 0;
-                        if (!m->opt_graphical) {
-                            printf("NOT, r%i <- false\n", addr1);
-                        }
-                    }
-                } else if (entry.arguments[0].type == ADDRESS) {
-                    addr1 = mem_get_addr(m, entry.arguments[0]);
-                    if (arg_get_value(m, entry.arguments[1]) == 0) {
-                        mem_write(m, addr1, 1);
-                        if (!m->opt_graphical) {
-                            printf("NOT, mem[%i] <- true\n", addr1);
-                        }
-                    } else {
-                        mem_write(m, addr1, 0);
-                        if (!m->opt_graphical) {
-                            printf("NOT, mem[%i] <- false\n", addr1);
-                        }
-                    }
-                } else {
-                    raise(m, "Inappropriate destination for NOT");
-                }
-            } else { 
-                raise(m, "Wrong number of arguments for NOT");
-            }
-            break;
-        case ADD:
-            if (entry.argc == 3) {
-                if (entry.arguments[0].type == REGISTER) {
-                    addr1 = entry.arguments[0].reg;
-                    m->R[addr1] = arg_get_value(m, entry.arguments[1]) 
-                        + arg_get_value(m, entry.arguments[2]);
-                    if (!m->opt_graphical) {
-                        printf("ADD, r%i <- %i\n", addr1, m->R[addr1]);
-                    }
-                } else if (entry.arguments[0].type == ADDRESS) {
-                    addr1 = mem_get_addr(m, entry.arguments[0]);
-                    mem_write(m, addr1, arg_get_value(m, entry.arguments[1]) 
-                              + arg_get_value(m, entry.arguments[2]));
-                    if (!m->opt_graphical) {
-                        printf("ADD, mem[%i] <- %i\n", addr1, mem_read(m, addr1));
-                    }
-                } else {
-                    raise(m, "Inappropriate destination for ADD");
-                }
-            } else { 
-                raise(m, "Wrong number of arguments for ADD");
-            }
-            break;
-        case SUB:
-            if (entry.argc == 3) {
-                if (entry.arguments[0].type == REGISTER) {
-                    addr1 = entry.arguments[0].reg;
-                    m->R[addr1] = arg_get_value(m, entry.arguments[1]) 
-                        - arg_get_value(m, entry.arguments[2]);
-                    if (!m->opt_graphical) {
-                        printf("SUB, r%i <- %i\n", addr1, m->R[addr1]);
-                    }
-                } else if (entry.arguments[0].type == ADDRESS) {
-                    addr1 = mem_get_addr(m, entry.arguments[0]);
-                    mem_write(m, addr1, arg_get_value(m, entry.arguments[1]) 
-                              - arg_get_value(m, entry.arguments[2]));
-                    if (!m->opt_graphical) {
-                        printf("SUB, mem[%i] <- %i\n", addr1, mem_read(m, addr1));
-                    }
-                } else {
-                    raise(m, "Inappropriate destination for SUB");
-                }
-            } else { 
-                raise(m, "Wrong number of arguments for SUB");
-            }
-            break;
-        case MULT:
-            if (entry.argc == 3) {
-                if (entry.arguments[0].type == REGISTER) {
-                    addr1 = entry.arguments[0].reg;
-                    m->R[addr1] = arg_get_value(m, entry.arguments[1]) 
-                        * arg_get_value(m, entry.arguments[2]);
-                    if (!m->opt_graphical) {
-                        printf("MULT, r%i <- %i\n", addr1, m->R[addr1]);
-                    }
-                } else if (entry.arguments[0].type == ADDRESS) {
-                    addr1 = mem_get_addr(m, entry.arguments[0]);
-                    mem_write(m, addr1, arg_get_value(m, entry.arguments[1]) 
-                              * arg_get_value(m, entry.arguments[2]));
-                    if (!m->opt_graphical) {
-                        printf("MULT, mem[%i] <- %i\n", addr1, mem_read(m, addr1));
-                    }
-                } else {
-                    raise(m, "Inappropriate destination for MULT");
-                }
-            } else { 
-                raise(m, "Wrong number of arguments for MULT");
-            }
-            break;
-        case DIV:
-            if (entry.argc == 3) {
-                if (arg_get_value(m, entry.arguments[2]) == 0) {
-                    raise(m, "Division by zero");
-                } else {
-                    if (entry.arguments[0].type == REGISTER) {
-                        addr1 = entry.arguments[0].reg;
-	
-                        m->R[addr1] = arg_get_value(m, entry.arguments[1]) 
-                            / arg_get_value(m, entry.arguments[2]);
-                        if (!m->opt_graphical) {
-                            printf("DIV, r%i <- %i\n", addr1, m->R[addr1]);
-                        }
-                    } else if (entry.arguments[0].type == ADDRESS) {
-                        addr1 = mem_get_addr(m, entry.arguments[0]);
-	
-                        mem_write(m, addr1, arg_get_value(m, entry.arguments[1]) 
-                                  / arg_get_value(m, entry.arguments[2]));
-                        if (!m->opt_graphical) {
-                            printf("DIV, mem[%i] <- %i\n", addr1, mem_read(m, addr1));
-                        }
-                    } else {
-                        raise(m, "Inappropriate destination for DIV");
-                    }
-                }
-            } else { 
-                raise(m, "Wrong number of arguments for DIV");
-            }
-            break;
-        case NEG:
-            if (entry.argc == 2) {
-                if (entry.arguments[0].type == REGISTER) {
-                    addr1 = entry.arguments[0].reg;
-                    m->R[addr1] = -1 * arg_get_value(m, entry.arguments[1]);
-                    if (!m->opt_graphical) {
-                        printf("NEG, r%i <- %i\n", addr1, m->R[addr1]);
-                    }
-                } else if (entry.arguments[0].type == ADDRESS) {
-                    addr1 = mem_get_addr(m, entry.arguments[0]);
-                    mem_write(m, addr1, -1 * arg_get_value(m, entry.arguments[1]));
-                    if (!m->opt_graphical) {
-                        printf("NEG, mem[%i] <- %i\n", addr1, mem_read(m, addr1));
-                    }
-                } else {
-                    raise(m, "Inappropriate destination for NEG");
-                }
-            } else {
-                raise(m, "Wrong number of arguments for NEG");
-            }
-            break;
-        default:
-            printf("Unknown opcode\n");
-        }
+    if (m->opt_graphical) {
+        //send input prompt
+        //wait for input
+        m->console_io_status = 1;
+        update_gui(m);
+        value = m->console_io_value;
+    } else {
+        fgets(str, 20, stdin);
+        value = atoi(str);
+    }
 
-        m->PC = m->nPC;
+    io_log_append(m, value);
+    return value;
+}
 
-        //ensures only count instructions are executed
-        if (count > 0 && --count == 0)
-            return -RUN_OK;
+/*
+  Target of a jump computed from registers, which may be anywhere
+ */
+static inline int jump_target(struct ami_machine *m, struct argument arg)
+{
+    int addr = add_get_value(m, arg);
+    if (addr < 0 || addr >= STACK_SIZE || !VALID_PC(m, addr)) {
+        raise(m, "Attempted to jump past instructions in stack");
     }
+    return addr;
+}
 
+#define ENGINE_NAME _run_plain
+#define ENGINE_HOOKS 0
+#define ENGINE_CHECKED 0
+#include "engine.h"
+
+#define ENGINE_NAME _run_hooked
+#define ENGINE_HOOKS 1
+#define ENGINE_CHECKED 0
+#include "engine.h"
+
+#define ENGINE_NAME _run_plain_checked
+#define ENGINE_HOOKS 0
+#define ENGINE_CHECKED 1
+#include "engine.h"
+
+#define ENGINE_NAME _run_hooked_checked
+#define ENGINE_HOOKS 1
+#define ENGINE_CHECKED 1
+#include "engine.h"
+
+/*
+  Trace recording, watchpoints, the cache, timing and branch
+  predictor models and loop detection only cost anything in the
+  hooked engine, which is selected only while one of them is active.
+  Programs that failed verification (and were run anyway with -u)
+  get the checked engines.
+ */
+void select_engine(struct ami_machine *m)
+{
+    m->hooks = m->trace != NULL || m->watch_count > 0 || m->cache != NULL
+        || m->timing != NULL || m->bpred != NULL || m->loops != NULL;
 }
 
+int _run(struct ami_machine* m, int count)
+{
+    int ret;
+
+    m->running = 1;
+    if (!m->verified)
+        ret = m->hooks ? _run_hooked_checked(m, count) : _run_plain_checked(m, count);
+    else if (m->hooks)
+        ret = _run_hooked(m, count);
+    else
+        ret = _run_plain(m, count);
+    m->running = 0;
+    return ret;
+}
 
+/*
+  Runs as 'continue' and 'step' do, within the limits set with
+  'limit' and 'loops'
+ */
 int run(struct ami_machine* m, int count)
 {
-    int ret = _run(m, count);
+    int ret;
 
+    limits_start(m);
+    ret = _run(m, count);
+    limits_stop(m);
 
     if (ret == -RUN_BREAKPOINT) {
-        skip_breakpoint();
+        skip_breakpoint(m);
+    } else if (ret == -RUN_WATCHPOINT) {
+        show_watchpoint(m);
+    } else if (ret == -RUN_BREAK) {
+        show_stop(m);
     } else if (ret == -RUN_HALTED) {
         if (m->opt_graphical) {
             if (m->console_io_status == 0) {
                 m->console_io_status = 3;
             }
-        } else {
+        } else if (!m->opt_quiet) {
             printf("Program is halted\n");
         }
     }
@@ -0,0 +1,177 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Samples the simulator on a CPU time interval timer (SIGPROF) and
+  on overflows of perf_event counters (SIGIO).  The handlers only
+  copy the interrupted host address and the AMI PC into a buffer
+  allocated up front; everything else is left to profile.c and
+  perfctr.c once sampling stops.
+ */
+
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <linux/perf_event.h>
+
+#include "sampler.h"
+
+#define MAX_COUNTERS 8
+
+static struct sample *samples;
+static volatile unsigned long count, dropped;
+static unsigned long capacity;
+static volatile unsigned int *sample_pc;
+static volatile int *sample_running;
+static int counter_fd[MAX_COUNTERS], counters;
+
+static void *interrupted_ip(void *context) {
+  ucontext_t *uc = context;
+#if defined(__x86_64__)
+  return (void *)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+  return (void *)uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+  return (void *)uc->uc_mcontext.pc;
+#else
+  return NULL;
+#endif
+}
+
+static void take_sample(void *context, int source) {
+  struct sample *s;
+
+  if (count == capacity) {
+    dropped++;
+    return;
+  }
+  s = &samples[count];
+  s->ip = interrupted_ip(context);
+  s->pc = *sample_pc;
+  s->running = *sample_running;
+  s->source = source;
+  count++;
+}
+
+static void on_sigprof(int sig, siginfo_t *info, void *context) {
+  take_sample(context, -1);
+}
+
+static void on_overflow(int sig, siginfo_t *info, void *context) {
+  int i;
+
+  for (i = 0; i < counters; i++) {
+    if (counter_fd[i] == info->si_fd) {
+      take_sample(context, i);
+      ioctl(counter_fd[i], PERF_EVENT_IOC_REFRESH, 1);
+      return;
+    }
+  }
+}
+
+/*
+  Starts taking hz samples per second of CPU time, keeping up to
+  capacity of them; an hz of 0 starts no timer, for sampling only on
+  counters.  Returns -1 if the buffer or timer cannot be set up.
+ */
+int sampler_start(volatile unsigned int *pc, volatile int *running, int hz,
+                  unsigned long size) {
+  struct sigaction sa;
+  struct itimerval timer;
+
+  samples = malloc(size * sizeof(struct sample));
+  if (!samples)
+    return -1;
+  capacity = size;
+  count = dropped = 0;
+  sample_pc = pc;
+  sample_running = running;
+  if (hz == 0)
+    return 0;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = on_sigprof;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGPROF, &sa, NULL) < 0)
+    return -1;
+
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = 1000000 / hz;
+  timer.it_value = timer.it_interval;
+  return setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/*
+  Opens a perf_event counter for this thread that takes a sample
+  every period events.  Returns its index for sample.source, or -1
+  with errno set if the kernel or PMU does not offer the event.
+ */
+int sampler_counter(unsigned int type, unsigned long config, unsigned long period) {
+  struct perf_event_attr attr;
+  struct f_owner_ex owner;
+  struct sigaction sa;
+  int fd;
+
+  if (counters == MAX_COUNTERS)
+    return -1;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.sample_period = period;
+  attr.wakeup_events = 1;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  if (fd < 0)
+    return -1;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = on_overflow;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGIO, &sa, NULL);
+
+  //deliver overflows to this thread, with the descriptor in si_fd
+  owner.type = F_OWNER_TID;
+  owner.pid = syscall(SYS_gettid);
+  if (fcntl(fd, F_SETFL, O_ASYNC) < 0 || fcntl(fd, F_SETSIG, SIGIO) < 0
+      || fcntl(fd, F_SETOWN_EX, &owner) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  counter_fd[counters] = fd;
+  ioctl(fd, PERF_EVENT_IOC_REFRESH, 1);
+  return counters++;
+}
+
+void sampler_stop(void) {
+  struct itimerval timer = { { 0, 0 }, { 0, 0 } };
+  int i;
+
+  setitimer(ITIMER_PROF, &timer, NULL);
+  signal(SIGPROF, SIG_IGN);
+  for (i = 0; i < counters; i++) {
+    ioctl(counter_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    close(counter_fd[i]);
+  }
+  counters = 0;
+}
+
+struct sample *sampler_samples(unsigned long *n, unsigned long *lost) {
+  *n = count;
+  *lost = dropped;
+  return samples;
+}
@@ -0,0 +1,19 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+// Signal driven sampling, kept apart from sim.h whose raise() clashes
+// with the one in <signal.h>
+
+struct sample {
+  void *ip;//host instruction interrupted
+  unsigned int pc;//AMI program counter
+  int running;//the engine was running
+  int source;//-1 for the timer, else the index from sampler_counter()
+};
+
+int sampler_start(volatile unsigned int *pc, volatile int *running, int hz,
+                  unsigned long capacity);
+int sampler_counter(unsigned int type, unsigned long config, unsigned long period);
+void sampler_stop(void);
+struct sample *sampler_samples(unsigned long *count, unsigned long *dropped);
@@ -0,0 +1,549 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Simulation server (-s SOCKET).  One long-lived process accepts
+  debugger sessions on a Unix domain socket and multiplexes them with
+  epoll.  A session speaks the debugger's own command language, one
+  command per line, and gets back what the command would print on a
+  terminal followed by a "> " prompt; 'socat - UNIX-CONNECT:SOCKET'
+  makes a usable client.  On top of the debugger's commands a session
+  has
+
+    open <file>    start over on another program
+    input <v>      give the value the program is waiting for
+
+  Sessions that open the same (unchanged) file share its decoded
+  image: the text, decoded instructions and basic blocks are built
+  once and copied into each new session's machine.
+
+  'continue' and 'step' are run SERVER_QUANTUM instructions at a time,
+  round robin with the other sessions' runs and between polls for new
+  commands, so a program that never halts slows the others down but
+  cannot stop them.  'explore', and 'continue' or 'step' inside a
+  script, would run to the end in one go and are refused.  A command
+  that arrives during a run stops the run first.  What a command or
+  slice prints is captured in a memfd and queued for the client, whose
+  socket is written without blocking; a run pauses while more than
+  SERVER_BACKLOG bytes wait, so a client that stops reading only holds
+  up itself.  A program that reads input with none given stops until
+  the session sends 'input', and a fault ends the session's program
+  instead of the server.
+ */
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+//<signal.h> declares a raise() that clashes with sim.h's
+#define raise signal_raise
+#include <signal.h>
+#undef raise
+
+#include "sim.h"
+
+#define SERVER_QUANTUM 100000//instructions a run gets before the next poll
+#define SERVER_EVENTS 64
+#define SERVER_LINE 1024//longest command line
+#define SERVER_BACKLOG (1 << 20)//output bytes queued before a run pauses
+
+/*
+  A loaded program shared by every session that opened the same file
+ */
+struct image {
+  struct ami_machine *m;//holds the text and decoded program
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  int users;
+  struct image *next;
+};
+
+struct session {
+  int fd;
+  struct ami_machine *m;
+  struct image *image;
+  jmp_buf escape;//faults and waits for input in m land here
+  char line[SERVER_LINE];
+  size_t len;
+  char *out;//output not yet taken by the client
+  size_t out_len, out_capacity;
+  long pending;//instructions left to run, -1 to run on until a stop
+  int waiting;//stopped at an input instruction
+  struct session *next;
+};
+
+static struct ami_machine *options;//command line options for new sessions
+static struct image *images;
+static struct session *sessions;
+static int stdout_fd, stderr_fd, capture_fd, epoll_fd;
+
+/*
+  Writes as much of c's queued output as the socket takes, and asks
+  epoll for a turn when it can take more
+ */
+static void flush_output(struct session *c) {
+  struct epoll_event ev;
+  ssize_t n = c->out_len ? write(c->fd, c->out, c->out_len) : 0;
+
+  if (n < 0 && errno != EAGAIN)
+    n = c->out_len;//the client is gone, which reading will find
+  if (n > 0) {
+    c->out_len -= n;
+    memmove(c->out, c->out + n, c->out_len);
+  }
+  ev.events = EPOLLIN | (c->out_len ? EPOLLOUT : 0);
+  ev.data.ptr = c;
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/*
+  Captures what is printed from here to end_output(c)
+ */
+static void begin_output(void) {
+  fflush(stdout);
+  dup2(capture_fd, 1);
+  dup2(capture_fd, 2);
+}
+
+/*
+  Queues the captured output for c and sends what it can
+ */
+static void end_output(struct session *c) {
+  off_t size;
+
+  fflush(stdout);
+  dup2(stdout_fd, 1);
+  dup2(stderr_fd, 2);
+
+  size = lseek(capture_fd, 0, SEEK_CUR);
+  if (size > 0 && c->out_len + size > c->out_capacity) {
+    c->out_capacity = c->out_len + size;
+    c->out = realloc(c->out, c->out_capacity);
+  }
+  if (size > 0 && pread(capture_fd, c->out + c->out_len, size, 0) == size)
+    c->out_len += size;
+  ftruncate(capture_fd, 0);
+  lseek(capture_fd, 0, SEEK_SET);
+  flush_output(c);
+}
+
+static void free_machine(struct ami_machine *m) {
+  struct breakpoint *b, *next;
+
+  for (b = m->breakpoints; b != NULL; b = next) {
+    next = b->next;
+    cond_free(b->cond);
+    free(b);
+  }
+  set_autoreload(m, 0);
+  cache_off(m);
+  trace_free(m->trace);
+  free(m->timing);
+  bpred_free(m->bpred);
+  if (m->history)
+    free(m->history->io);
+  free(m->history);
+  arena_free(&m->program);
+  arena_free(&m->scratch);
+  arena_free(&m->spare);
+  free(m->filename);
+  free(m);
+}
+
+static struct ami_machine *new_machine(char *filename) {
+  struct ami_machine *m = create_ami_machine();
+
+  m->filename = strdup(filename);
+  m->reg_count = 1;
+  m->opt_printstack = -1;
+  m->opt_optimize = options->opt_optimize;
+  m->opt_lazy = options->opt_lazy;
+  m->opt_noverify = options->opt_noverify;
+  m->max_steps = options->max_steps;
+  m->max_seconds = options->max_seconds;
+  if (options->loops)
+    set_loop_detection(m, 1);
+  return m;
+}
+
+static void release_image(struct image *im) {
+  struct image **pprev = &images;
+
+  if (!im || --im->users > 0)
+    return;
+  while (*pprev != im)
+    pprev = &(*pprev)->next;
+  *pprev = im->next;
+  free_machine(im->m);
+  free(im);
+}
+
+/*
+  Returns the image of filename, loading it unless a session already
+  has it and the file has not changed since.  NULL if it cannot be
+  loaded; the reason has been printed.
+ */
+static struct image *get_image(char *filename) {
+  struct image *im;
+  struct stat st;
+  jmp_buf escape;
+
+  if (stat(filename, &st) < 0) {
+    perror(filename);
+    return NULL;
+  }
+  for (im = images; im != NULL; im = im->next) {
+    if (im->dev == st.st_dev && im->ino == st.st_ino
+        && im->mtime.tv_sec == st.st_mtim.tv_sec && im->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+      im->users++;
+      return im;
+    }
+  }
+
+  im = calloc(1, sizeof(struct image));
+  im->m = new_machine(filename);
+  im->m->opt_quiet = 1;
+  im->m->escape = &escape;
+  if (setjmp(escape)) {
+    free_machine(im->m);
+    free(im);
+    return NULL;
+  }
+  allocate_stack(im->m);
+  im->m->escape = NULL;
+
+  im->dev = st.st_dev;
+  im->ino = st.st_ino;
+  im->mtime = st.st_mtim;
+  im->users = 1;
+  im->next = images;
+  images = im;
+  return im;
+}
+
+/*
+  Copies the program of from into the freshly created to, whose
+  instruction text stays in from's arena
+ */
+static void share_program(struct ami_machine *to, struct ami_machine *from) {
+  memcpy(to->mem, from->mem, sizeof(to->mem));
+  to->slots_used = from->slots_used;
+  to->verified = from->verified;
+  to->reg_count = from->reg_count;
+  memcpy(to->blocks, from->blocks, from->block_count * sizeof(struct block));
+  to->block_count = from->block_count;
+  memcpy(to->block_of, from->block_of, sizeof(to->block_of));
+  memcpy(to->valid_pc, from->valid_pc, sizeof(to->valid_pc));
+  select_engine(to);
+}
+
+/*
+  Replaces c's machine with a new one running filename.  Returns -1,
+  keeping the old machine, if the program cannot be loaded.
+ */
+static int open_program(struct session *c, char *filename) {
+  struct image *im = get_image(filename);
+
+  if (!im)
+    return -1;
+  if (c->m)
+    free_machine(c->m);
+  release_image(c->image);
+  c->image = im;
+  c->m = new_machine(filename);
+  c->m->escape = &c->escape;
+  share_program(c->m, im->m);
+  c->pending = 0;
+  c->waiting = 0;
+  printf("Filename: %s\n", filename);
+  return 0;
+}
+
+//a run stopped for input goes on once it has some
+static int runnable(struct session *c) {
+  return c->pending && !c->waiting && c->out_len < SERVER_BACKLOG;
+}
+
+/*
+  The limits set with 'limit' cover a whole 'continue' or 'step',
+  however many slices it takes
+ */
+static void start_run(struct session *c, long count) {
+  if (!c->pending)
+    limits_start(c->m);
+  c->pending = count;
+}
+
+static void end_run(struct session *c) {
+  if (c->pending)
+    limits_stop(c->m);
+  c->pending = 0;
+}
+
+static void prompt(struct session *c) {
+  if (c->m->opt_dumpreg)
+    dump_registers(c->m);
+  if (c->m->opt_printstack != -1)
+    dump_stack(c->m, c->m->opt_printstack);
+  printf("> ");
+}
+
+static void close_session(struct session *c) {
+  struct session **pprev = &sessions;
+
+  while (*pprev != c)
+    pprev = &(*pprev)->next;
+  *pprev = c->next;
+  close(c->fd);
+  if (c->m)
+    free_machine(c->m);
+  release_image(c->image);
+  free(c->out);
+  free(c);
+}
+
+/*
+  Handles a longjmp to c->escape with status ret
+ */
+static void escaped(struct session *c, int ret) {
+  struct ami_machine *m = c->m;
+
+  m->running = 0;
+  m->batch = 0;
+  //run() did not get to stop its limits, only ours are left
+  m->guarded = c->pending ? 1 : 0;
+  if (ret == RUN_INPUT) {
+    c->waiting = 1;
+    printf("waiting for input at pc %u, send 'input <value>'\n", m->PC);
+  } else {
+    //the program cannot go on past a fault
+    m->halted = 1;
+    end_run(c);
+  }
+}
+
+/*
+  Runs the next slice of c's 'continue' or 'step'
+ */
+static void run_slice(struct session *c) {
+  struct ami_machine *m = c->m;
+  unsigned long before = m->icount;
+  int count = c->pending > 0 && c->pending < SERVER_QUANTUM ? c->pending : SERVER_QUANTUM;
+  int ret;
+
+  begin_output();
+  if ((ret = setjmp(c->escape)) == 0) {
+    ret = run(m, count);
+    if (ret != -RUN_OK || c->pending == (long)(m->icount - before))
+      end_run(c);
+    else if (c->pending > 0)
+      c->pending -= (long)(m->icount - before);
+  } else {
+    escaped(c, ret);
+    if (c->pending > 0)
+      c->pending -= (long)(m->icount - before);
+  }
+  if (!c->pending || c->waiting)
+    prompt(c);
+  end_output(c);
+}
+
+/*
+  Runs one command line from c.  Returns -1 if the session is over.
+ */
+static int session_command(struct session *c, char *line) {
+  struct ami_machine *m = c->m;
+  char copy[SERVER_LINE], *cmd, *arg;
+  int ret;
+
+  strcpy(copy, line);
+  cmd = strtok(copy, " \t\r");
+  arg = strtok(NULL, " \t\r");
+  if (!cmd)
+    return 0;
+
+  begin_output();
+  if (c->pending && !c->waiting) {
+    printf("stopped at pc %u\n", m->PC);
+    end_run(c);
+  }
+  if (m->autoreload_fd)
+    check_autoreload(m);
+
+  if (!strpcmp(cmd, "quit") || !strpcmp(cmd, "exit")) {
+    printf("exiting debugger\n");
+    end_output(c);
+    return -1;
+  } else if (!strpcmp(cmd, "continue")) {
+    start_run(c, -1);
+  } else if (!strpcmp(cmd, "step")) {
+    long steps = arg ? atol(arg) : 1;
+    if (steps <= 0)
+      printf("expected a positive integer, but got '%s' instead\n", arg);
+    else
+      start_run(c, steps);
+  } else if (!strcmp(cmd, "open")) {
+    if (!arg)
+      printf("expected a file name\n");
+    else
+      open_program(c, arg);
+  } else if (!strcmp(cmd, "input")) {
+    if (!arg) {
+      printf("expected a value\n");
+    } else if (m->halted || !is_input(m, m->PC)) {
+      printf("the program is not at an input instruction\n");
+    } else {
+      io_log_insert(m, atoi(arg));
+      c->waiting = 0;
+    }
+  } else if ((ret = setjmp(c->escape)) == 0) {
+    debug_command(m, line);
+    //e.g. after a reset
+    if (c->waiting && (m->halted || !is_input(m, m->PC))) {
+      c->waiting = 0;
+      end_run(c);
+    }
+  } else {
+    escaped(c, ret);
+  }
+
+  if (c->waiting && c->pending)
+    printf("waiting for input at pc %u, send 'input <value>'\n", c->m->PC);
+  if (!c->pending || c->waiting)
+    prompt(c);
+  end_output(c);
+  return 0;
+}
+
+static void session_input(struct session *c) {
+  ssize_t n = read(c->fd, c->line + c->len, sizeof(c->line) - 1 - c->len);
+  char *start, *end;
+
+  if (n < 0 && errno == EAGAIN)
+    return;
+  if (n <= 0) {
+    close_session(c);
+    return;
+  }
+  c->len += n;
+  c->line[c->len] = '\0';
+
+  for (start = c->line; (end = strchr(start, '\n')) != NULL; start = end + 1) {
+    *end = '\0';
+    if (session_command(c, start) < 0) {
+      close_session(c);
+      return;
+    }
+  }
+  c->len -= start - c->line;
+  memmove(c->line, start, c->len);
+
+  if (c->len == sizeof(c->line) - 1) {
+    begin_output();
+    printf("command longer than %d characters ignored\n> ", SERVER_LINE - 1);
+    end_output(c);
+    c->len = 0;
+  }
+}
+
+static void accept_session(int listener, char *filename) {
+  struct epoll_event ev;
+  struct session *c;
+  int fd = accept(listener, NULL, NULL);
+
+  if (fd < 0)
+    return;
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  c = calloc(1, sizeof(struct session));
+  c->fd = fd;
+  ev.events = EPOLLIN;
+  ev.data.ptr = c;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+  c->next = sessions;
+  sessions = c;
+
+  begin_output();
+  if (open_program(c, filename) < 0) {
+    end_output(c);
+    close_session(c);
+    return;
+  }
+  printf("Welcome to the AMI simulator built-in debugger. Type 'help' for a listing of commands.\n");
+  prompt(c);
+  end_output(c);
+}
+
+/*
+  Serves sessions on the socket at path until killed; each starts
+  with the program in m->filename and the options in m
+ */
+void run_server(struct ami_machine *m, char *path) {
+  struct sockaddr_un addr;
+  struct epoll_event ev, events[SERVER_EVENTS];
+  struct session *c, *next;
+  int listener, n, i, busy;
+
+  options = m;
+  signal(SIGPIPE, SIG_IGN);//a client that hangs up just ends its session
+  stdout_fd = dup(1);
+  stderr_fd = dup(2);
+  capture_fd = memfd_create("session output", 0);
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    printf("Socket path too long: %s\n", path);
+    exit(1);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0
+      || listen(listener, SOMAXCONN) < 0) {
+    perror("Cannot listen");
+    exit(1);
+  }
+  epoll_fd = epoll_create1(0);
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener, &ev);
+  printf("Serving %s on %s\n", m->filename, path);
+  fflush(stdout);
+
+  for (;;) {
+    busy = 0;
+    for (c = sessions; c != NULL; c = c->next)
+      busy |= runnable(c);
+
+    n = epoll_wait(epoll_fd, events, SERVER_EVENTS, busy ? 0 : -1);
+    if (n < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      exit(1);
+    }
+    for (i = 0; i < n; i++) {
+      if (events[i].data.ptr == NULL)
+        accept_session(listener, m->filename);
+      else if (events[i].events & EPOLLOUT)
+        flush_output(events[i].data.ptr);
+      if (events[i].data.ptr && events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        session_input(events[i].data.ptr);
+    }
+
+    for (c = sessions; c != NULL; c = next) {
+      next = c->next;
+      if (runnable(c))
+        run_slice(c);
+    }
+  }
+}
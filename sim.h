@@ -18,12 +18,13 @@
   move address to address, immediate data move, immediate data move w/ negative 
   number, load, store, register comparisons (equal to, not equal to, less than,
   less than or equal to), numerical arithmetic (and, or, not, addition, 
-  subtraction, multiplication, division, negation)
+  subtraction, multiplication, division, negation), and no operation
+  (left by the optimizer in place of removed instructions)
  */
 enum {
   HALT, WRITE, READB, READI, JUMPIF, JUMPNIF, JUMP,
   MOVE, IDM, LOAD, STORE, EQ, NEQ, LT, LTE, AND, OR, 
-  NOT, ADD, SUB, MULT, DIV, NEG
+  NOT, ADD, SUB, MULT, DIV, NEG, NOP, ILLEGAL
 };
 
 /*
@@ -62,20 +63,265 @@ struct stack_entry {
   int data;
   unsigned int op, data_type, argc;
   struct argument arguments[3];
+  char *error;//why an ILLEGAL instruction failed to decode
+  unsigned int line;//line in the source file, from 1
+  int target;//jump target resolved at load, -1 if computed at run time
 };
 
 #define MAX_SEGMENTS 16
 #define MAX_REGISTERS 100
+//may be raised at build time (-DSTACK_SIZE=...) for very large programs
+#ifndef STACK_SIZE
 #define STACK_SIZE 256
+#endif
 
 
+/*
+  Kinds of side effects captured by the trace recorder
+ */
+enum {
+  TRACE_NONE, TRACE_REG, TRACE_MEM, TRACE_JUMP
+};
+
+struct trace_record {
+  unsigned int pc;
+  unsigned char op, kind;
+  unsigned int dest;//register, address or jump target written
+  int value;
+};
+
+struct trace_buffer {
+  struct trace_record *records;//ring of mask + 1 records
+  unsigned long mask;
+  unsigned long head;//total records ever written
+};
+
+#define TRACE_MAGIC "AMITRACE"
+#define TRACE_VERSION 1
+#define TRACE_DEFAULT_SIZE 65536
+#define TRACE_FAULT_RECORDS 16
+
+struct trace_header {
+  char magic[8];
+  unsigned int version, record_size;
+  unsigned long first, count;
+};
+
+/*
+  Snapshot file layout, see snapshot.c.  Offsets are from the start
+  of the file.
+ */
+#define SNAPSHOT_MAGIC "AMISNAP"
+#define SNAPSHOT_VERSION 1
+
+struct snapshot_header {
+  char magic[8];
+  unsigned int version, header_size;
+  unsigned int stack_size, max_registers;//sizes of the arrays
+  unsigned long program_hash;//of the instruction text
+  unsigned int slots_used;
+  unsigned int PC, nPC;
+  int halted;
+  unsigned long icount;
+  int console_io_status, console_io_value;
+  int R[MAX_REGISTERS];
+  unsigned long data_offset;//int[stack_size]
+  unsigned long watch_offset;//unsigned char[stack_size]
+  unsigned long breakpoint_offset;//struct snapshot_breakpoint[breakpoint_count]
+  unsigned long breakpoint_count;
+  unsigned long strings_offset;//breakpoint conditions
+  unsigned long size;//of the whole file
+};
+
+struct snapshot_breakpoint {
+  unsigned int addr;
+  int enabled;
+  long cond;//offset of the text from strings_offset, -1 for none
+};
+
+/*
+  Reverse execution history: periodic snapshots of the run state
+  plus a log of every value read from the console
+ */
+#define MAX_CHECKPOINTS 1024
+#define CHECKPOINT_INTERVAL 1024
+
+struct checkpoint {
+  unsigned long icount;//instructions retired when taken
+  unsigned int PC;
+  int halted;
+  int R[MAX_REGISTERS];
+  int data[STACK_SIZE];
+};
+
+struct io_event {
+  unsigned long icount;//instruction that read the value
+  int value;
+};
+
+struct history {
+  struct checkpoint cp[MAX_CHECKPOINTS];//ordered by icount
+  int count;
+  unsigned long interval;//instructions between checkpoints
+  struct io_event *io;//ordered by icount
+  unsigned long io_count, io_capacity;
+  unsigned long io_pos;//next event to replay
+};
+
+/*
+  Cache hierarchy model, see cache.c.  Sizes are in memory slots.
+ */
+#define MAX_CACHE_LEVELS 4
+enum { CACHE_LRU, CACHE_FIFO };
+
+struct cache_line {
+  unsigned int tag;
+  unsigned long stamp;//last use (LRU) or fill (FIFO)
+  char valid, dirty;
+};
+
+struct cache_level {
+  unsigned int size, line, assoc, sets;
+  int replace;//CACHE_LRU or CACHE_FIFO
+  int write_back;//else write through without allocating on a miss
+  struct cache_line *lines;//sets * assoc
+  unsigned long reads, read_misses, writes, write_misses, writebacks;
+};
+
+struct cache_pc_stats {
+  unsigned long accesses;
+  unsigned long misses[MAX_CACHE_LEVELS];
+};
+
+struct cache {
+  int levels;//level 0 is closest to the CPU
+  struct cache_level level[MAX_CACHE_LEVELS];
+  unsigned long clock;
+  struct cache_pc_stats pc[STACK_SIZE];//by PC of the accessing instruction
+};
+
+/*
+  Pipeline timing model, see timing.c
+ */
+enum { STALL_RAW, STALL_LOAD_USE, STALL_MULTICYCLE, STALL_BRANCH, STALL_KINDS };
+
+struct timing_pc_stats {
+  unsigned long count;
+  unsigned long stalls[STALL_KINDS];
+};
+
+struct timing {
+  int forwarding;//results are forwarded to EX instead of read after WB
+  unsigned long cycles;//cycle the last instruction left WB
+  unsigned long next_ex;//first cycle the next instruction may enter EX
+  unsigned long ready[MAX_REGISTERS];//first cycle EX may use each register
+  char loaded[MAX_REGISTERS];//register was last written from memory
+  unsigned long instructions;
+  unsigned long stalls[STALL_KINDS];
+  struct timing_pc_stats pc[STACK_SIZE];
+};
+
+/*
+  Branch predictor model, see bpred.c
+ */
+enum { BPRED_STATIC, BPRED_ONEBIT, BPRED_TWOBIT, BPRED_GSHARE };
+#define BPRED_DEFAULT_ENTRIES 1024
+
+struct btb_entry {
+  unsigned int pc, target;
+  unsigned long stamp;//last use
+  char valid;
+};
+
+struct bpred_pc_stats {
+  unsigned long count, taken, mispredicts;
+};
+
+struct bpred {
+  int kind;
+  unsigned int entries;//counters, a power of two
+  unsigned char *counters;
+  unsigned int history;//recent outcomes for gshare, newest in bit 0
+  unsigned int btb_sets, btb_assoc;//no BTB if 0
+  struct btb_entry *btb;
+  unsigned long btb_clock;
+  int last_miss;//the last branch was mispredicted
+  unsigned long branches, mispredicts, btb_misses;
+  struct bpred_pc_stats pc[STACK_SIZE];
+};
+
+/*
+  Values written by the program while it runs quietly
+ */
+struct output_log {
+  int *values;
+  unsigned long count, capacity;//count may pass capacity; the rest are dropped
+};
+
+/*
+  Why a run ended with RUN_BREAK, see watchdog.c
+ */
+enum { STOP_NONE, STOP_INTERRUPT, STOP_STEPS, STOP_TIME, STOP_LOOP };
+
+struct loop_detector {
+  int saved;//a state has been saved since the search started
+  unsigned long jumps, power;//backward jumps since the save, and before the next
+  unsigned long hash, icount;//of the saved state
+  unsigned long period;//instructions round the loop once one is found
+  unsigned int PC;
+  int R[MAX_REGISTERS];
+  int data[STACK_SIZE];
+  unsigned char dirty[(STACK_SIZE + 7) / 8];//slots written since the search started
+  unsigned int written[STACK_SIZE];//the same slots, in order
+  unsigned int written_count;
+};
+
+/*
+  Watchpoint flags, kept per memory address
+ */
+#define WATCH_WRITE 1
+#define WATCH_READ 2
+
+/*
+  A breakpoint condition compiled to postfix code
+ */
+#define MAX_COND_CODE 64
+#define MAX_COND_STACK 16
+
+struct cond {
+  char *text;//as typed, for listing
+  int len, max_depth;
+  int code[MAX_COND_CODE];
+};
+
+/*
+  A straight-line run of instructions entered at start and left after
+  end - 1, the only instruction in it that can jump or halt
+ */
+#define NO_BLOCK ((unsigned int)-1)//block_of for slots not decoded yet
+
+struct block {
+  unsigned int start, end;
+  int breakpoints;//a breakpoint is set past start
+  unsigned long entries;//times execution entered the block
+};
+
 struct breakpoint {
   int id;
   int enabled;
   unsigned int addr;
+  struct cond *cond;//stop only when true, NULL to always stop
   struct breakpoint *next;
 };
 
+/*
+  Memory released all at once, see arena.c
+ */
+struct arena {
+  struct arena_chunk *first, *current;
+  size_t used;//bytes handed out from current
+};
+
 struct ami_machine {
     /* debug options */
     int opt_printstack;//for 'print' command with stack
@@ -85,6 +331,33 @@ struct ami_machine {
     int opt_ac;//command line argument count
     char **opt_av;//command line arguments
     struct breakpoint *breakpoints;//list of breakpoints
+    char *script;//debugger commands to run at startup
+    int opt_bench;//repetitions to time in benchmark mode, 0 for a session
+    char *profile;//file for the sampling profiler's folded stacks, or NULL
+    int opt_counters;//benchmark with per-opcode host counters instead of timings
+    char *restore;//snapshot to load at startup, or NULL
+    char *save;//file to save a snapshot to at exit, or NULL
+    int batch;//depth of nested scripts being run
+    struct trace_buffer *trace;//execution trace, NULL when off
+    struct cache *cache;//cache hierarchy model, NULL when off
+    struct timing *timing;//pipeline timing model, NULL when off
+    struct bpred *bpred;//branch predictor model, NULL when off
+    struct output_log *outputs;//where quiet runs keep written values, or NULL
+    struct loop_detector *loops;//NULL when off
+    unsigned long max_steps;//instructions a run may take, 0 for no limit
+    double max_seconds;//wall-clock time a run may take, 0 for no limit
+    unsigned char watch[STACK_SIZE];//WATCH_* flags for each address
+    int watch_count;//number of watched addresses
+    int watch_hit;//a watched address was accessed by this instruction
+    unsigned int watch_addr;//address and kind of the last watch hit
+    int watch_kind, watch_old;
+    int hooks;//run the engine with trace and watchpoint hooks
+    int opt_noverify;//run programs that fail verification anyway
+    int opt_optimize;//run the peephole optimizer on loaded programs
+    int opt_lazy;//decode each block when it is first run
+    int autoreload_fd;//inotify descriptor watching the program file, 0 when off
+    char *serve;//socket to serve sessions on, or NULL
+    jmp_buf *escape;//raise() and input with none given jump here, NULL to exit or wait
 
     /* gui management */
     char *shm;//pointer to shared memory
@@ -94,11 +367,29 @@ struct ami_machine {
 
     /* run state */
     int halted;//halts the simulator after executing a 'halt' command
+    int running;//inside _run(), for the profiler
+    int opt_quiet;//suppress per-instruction output in text mode
+    unsigned long icount;//instructions retired since reset
+    unsigned long next_checkpoint;//icount of the next history snapshot
+    volatile unsigned long next_check;//icount at which to call run_check(), 0 for at once
+    volatile int stop;//STOP_* reason to end the run at the next check
+    int guarded;//the limits apply to the run in progress
+    unsigned long stop_icount;//where the instruction limit runs out
+    double deadline;//when the time limit runs out
+    struct history *history;//for reverse execution
 
     /* memory state */
     struct stack_entry mem[STACK_SIZE];//virtual memory for 
                                        //instructions & data
     unsigned int slots_used;//# of mem slots that are instructions
+    struct arena program;//text and other data of the loaded program
+    struct arena scratch;//strings formatted for one GUI update
+    struct arena spare;//text of a program being reloaded
+    int verified;//every instruction passed verify_program()
+    struct block blocks[STACK_SIZE];//basic blocks of the program
+    unsigned int block_count;
+    unsigned int block_of[STACK_SIZE];//index of the block holding each slot
+    unsigned char valid_pc[(STACK_SIZE + 7) / 8];//bit set for each instruction slot
 
     /* CPU registers */
     int R[MAX_REGISTERS];//virtual registers
@@ -109,6 +400,7 @@ struct ami_machine {
 
 struct ami_machine *create_ami_machine(void);
 void allocate_stack(struct ami_machine *m);
+void reset_machine(struct ami_machine *m);
 void push_arguments(struct ami_machine *m);
 void free_segments(struct ami_machine *m);
 struct stack_entry *allocate_segment(struct ami_machine *m, unsigned int addr, unsigned int size, char *type);
@@ -124,20 +416,122 @@ int add_get_value(struct ami_machine *m, struct argument add);
 int mem_get_addr(struct ami_machine *m, struct argument arg);
 int mem_read(struct ami_machine *m, unsigned int addr);
 void mem_write(struct ami_machine *m, unsigned int addr, int value);
+int arg_get_value_watched(struct ami_machine *m, struct argument arg);
+int mem_read_watched(struct ami_machine *m, unsigned int addr);
+void mem_write_watched(struct ami_machine *m, unsigned int addr, int value);
+void set_watchpoint(struct ami_machine *m, unsigned int addr, int kind);
+void show_watchpoint(struct ami_machine *m);
 char *read_stack_entry(struct ami_machine *m, int addr);
 
-char *readfile(char *filename);
+char *readfile(char *filename, struct arena *a);
+
+void *arena_alloc(struct arena *a, size_t size);
+char *arena_printf(struct arena *a, const char *format, ...);
+void arena_reset(struct arena *a);
+void arena_free(struct arena *a);
+
+struct history *history_create(void);
+void history_reset(struct ami_machine *m);
+void take_checkpoint(struct ami_machine *m);
+int io_log_replay(struct ami_machine *m, int *value);
+void io_log_append(struct ami_machine *m, int value);
+void io_log_insert(struct ami_machine *m, int value);
+int reverse_step(struct ami_machine *m, unsigned long steps);
+int reverse_continue(struct ami_machine *m);
+
+struct cond *cond_compile(char *text);
+void cond_free(struct cond *c);
+int cond_eval(struct ami_machine *m, struct cond *c);
 
-struct stack_entry disasm_instr(struct ami_machine *m, char *instr);
-char *read_argument(struct stack_entry *ret, char *token, char *stop_words[], int words);
-void init_stop_words(char *stop_words[]);
+char *opcode_name(unsigned int op);
+struct trace_buffer *trace_create(unsigned long size);
+void trace_free(struct trace_buffer *t);
+void trace_format(FILE *out, unsigned long seq, struct trace_record *r);
+void trace_print(struct trace_buffer *t, FILE *out, unsigned long count);
+int trace_save(struct trace_buffer *t, char *filename);
 
-enum { RUN_OK=0, RUN_BREAK=1, RUN_BREAKPOINT=2, RUN_FAULT=3, RUN_EXIT=4, RUN_HALTED=5 };
+int cache_add_level(struct ami_machine *m, unsigned int size, unsigned int line,
+                    unsigned int assoc, int replace, int write_back);
+void cache_off(struct ami_machine *m);
+void cache_clear(struct cache *c);
+void cache_access(struct ami_machine *m, unsigned int addr, int write);
+void dump_cache(struct ami_machine *m);
+
+struct timing *timing_create(int forwarding);
+void timing_clear(struct timing *t);
+void timing_instruction(struct ami_machine *m, unsigned int pc, struct stack_entry *entry);
+void dump_timing(struct ami_machine *m);
+
+int bpred_kind(char *name);
+char *bpred_name(int kind);
+struct bpred *bpred_create(int kind, unsigned int entries, unsigned int btb_entries,
+                           unsigned int btb_assoc);
+void bpred_free(struct bpred *b);
+void bpred_clear(struct bpred *b);
+void bpred_branch(struct ami_machine *m, unsigned int pc, int taken, unsigned int target);
+void dump_bpred(struct ami_machine *m);
+
+char *instruction_error(struct ami_machine *m, struct stack_entry *e);
+int verify_program(struct ami_machine *m);
+int constant_target(struct argument *arg, int *target);
+
+int optimize_program(struct ami_machine *m);
+
+void build_blocks(struct ami_machine *m);
+void forget_blocks(struct ami_machine *m);
+void discover_block(struct ami_machine *m, unsigned int pc);
+void mark_breakpoint_blocks(struct ami_machine *m);
+void dump_blocks(struct ami_machine *m);
+#define VALID_PC(m, pc) ((m)->valid_pc[(pc) >> 3] & (1 << ((pc) & 7)))
+
+int decode_instr(const char *text, struct stack_entry *ret, int *reg_count);
+void decode_program(struct ami_machine *m);
+
+int snapshot_save(struct ami_machine *m, char *filename);
+int snapshot_load(struct ami_machine *m, char *filename);
+void snapshot_at_exit(struct ami_machine *m, char *filename);
+
+#define EXPLORE_DEFAULT_BUDGET 10000000
+void explore_inputs(struct ami_machine *m, int *values, int count, int budget);
+void output_append(struct output_log *log, int value);
+int is_input(struct ami_machine *m, unsigned int pc);
+
+void catch_interrupts(struct ami_machine *m);
+void limits_start(struct ami_machine *m);
+void limits_stop(struct ami_machine *m);
+int run_check(struct ami_machine *m);
+void show_stop(struct ami_machine *m);
+void dump_limits(struct ami_machine *m);
+int set_loop_detection(struct ami_machine *m, int on);
+void loop_reset(struct ami_machine *m);
+void loop_write(struct ami_machine *m, unsigned int addr);
+void loop_jump(struct ami_machine *m);
+
+int reload_program(struct ami_machine *m);
+int set_autoreload(struct ami_machine *m, int on);
+void check_autoreload(struct ami_machine *m);
+
+enum { RUN_OK=0, RUN_BREAK=1, RUN_BREAKPOINT=2, RUN_FAULT=3, RUN_EXIT=4, RUN_HALTED=5, RUN_WATCHPOINT=6, RUN_INPUT=7 };
 int run(struct ami_machine* m, int count);
+void select_engine(struct ami_machine *m);
+int _run(struct ami_machine* m, int count);
 void show_exit_status(struct ami_machine *m);
 void update_gui(struct ami_machine *m);
 void interactive_debug(struct ami_machine* m);
+void source_script(struct ami_machine *m, char *filename);
+void debug_command(struct ami_machine *m, char *line);
+int strpcmp(char *shortstring, char *longstring);
+void run_server(struct ami_machine *m, char *path);
+
+void run_benchmark(struct ami_machine *m, int reps);
+void profile_start(struct ami_machine *m, char *filename);
+void run_counters(struct ami_machine *m, int reps);
 int is_breakpoint(struct ami_machine *m, unsigned int addr);
+int find_breakpoint(struct ami_machine *m, unsigned int addr);
+int add_breakpoint(struct ami_machine *m, unsigned int addr, struct cond *cond);
+void del_breakpoint(struct ami_machine *m, unsigned int id);
+void skip_breakpoint(struct ami_machine *m);
+void unskip_breakpoints(struct ami_machine *m);
 int dosyscall(struct ami_machine *m);
 void raise(struct ami_machine *m, char *msg) __attribute__ ((noreturn));
 extern jmp_buf err_handler;
@@ -0,0 +1,266 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Machine snapshots.  A snapshot holds the run state of a machine:
+  PC, registers, data memory, the halted flag, pending GUI console
+  I/O, breakpoints (with their conditions) and watchpoints.  The
+  program itself is not saved; a snapshot can only be loaded into a
+  machine running the same program text, which a hash checks.
+
+  The file is a header followed by arrays at the offsets it gives
+  (see struct snapshot_header), so loading one is a single mmap,
+  copies out of the mapping and recompiling the breakpoint
+  conditions, however long the run that reached it was.
+
+  Reverse execution history is not saved; it starts over from the
+  loaded state.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sim.h"
+
+//FNV-1a over the instruction text
+static unsigned long program_hash(struct ami_machine *m) {
+  unsigned long h = 14695981039346656037UL;
+  unsigned int i;
+  char *s;
+
+  for (i = 0; i < m->slots_used; i++) {
+    for (s = m->mem[i].instruction; *s; s++)
+      h = (h ^ (unsigned char)*s) * 1099511628211UL;
+    h = (h ^ '\n') * 1099511628211UL;
+  }
+  return h;
+}
+
+/*
+  Writes m's run state to filename.  Returns 0, or -1 with errno set.
+ */
+int snapshot_save(struct ami_machine *m, char *filename) {
+  struct snapshot_header *h;
+  struct snapshot_breakpoint *sb;
+  struct breakpoint *b;
+  unsigned long count = 0, strings = 0, size;
+  char *file, *text;
+  int *data, i;
+  FILE *out;
+
+  for (b = m->breakpoints; b != NULL; b = b->next) {
+    count++;
+    if (b->cond)
+      strings += strlen(b->cond->text) + 1;
+  }
+
+  size = sizeof(struct snapshot_header) + STACK_SIZE * sizeof(int) + STACK_SIZE
+    + count * sizeof(struct snapshot_breakpoint) + strings;
+  file = calloc(1, size);
+  if (!file)
+    return -1;
+
+  h = (struct snapshot_header *)file;
+  memcpy(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic));
+  h->version = SNAPSHOT_VERSION;
+  h->header_size = sizeof(struct snapshot_header);
+  h->stack_size = STACK_SIZE;
+  h->max_registers = MAX_REGISTERS;
+  h->program_hash = program_hash(m);
+  h->slots_used = m->slots_used;
+  h->PC = m->PC;
+  h->nPC = m->nPC;
+  h->halted = m->halted;
+  h->icount = m->icount;
+  h->console_io_status = m->console_io_status;
+  h->console_io_value = m->console_io_value;
+  memcpy(h->R, m->R, sizeof(h->R));
+
+  h->data_offset = sizeof(struct snapshot_header);
+  h->watch_offset = h->data_offset + STACK_SIZE * sizeof(int);
+  h->breakpoint_offset = h->watch_offset + STACK_SIZE;
+  h->breakpoint_count = count;
+  h->strings_offset = h->breakpoint_offset + count * sizeof(struct snapshot_breakpoint);
+  h->size = size;
+
+  data = (int *)(file + h->data_offset);
+  for (i = 0; i < STACK_SIZE; i++)
+    data[i] = m->mem[i].data;
+  memcpy(file + h->watch_offset, m->watch, STACK_SIZE);
+
+  sb = (struct snapshot_breakpoint *)(file + h->breakpoint_offset);
+  text = file + h->strings_offset;
+  for (b = m->breakpoints; b != NULL; b = b->next, sb++) {
+    sb->addr = b->addr;
+    sb->enabled = b->enabled;
+    sb->cond = -1;
+    if (b->cond) {
+      sb->cond = text - (file + h->strings_offset);
+      strcpy(text, b->cond->text);
+      text += strlen(text) + 1;
+    }
+  }
+
+  out = fopen(filename, "wb");
+  if (!out) {
+    free(file);
+    return -1;
+  }
+  fwrite(file, size, 1, out);
+  free(file);
+  return fclose(out);
+}
+
+/*
+  Checks a mapped snapshot against this build and m's program.
+  Returns what is wrong, or NULL.
+ */
+static char *snapshot_error(struct ami_machine *m, struct snapshot_header *h,
+                            unsigned long size) {
+  char *file = (char *)h;
+  struct snapshot_breakpoint *sb;
+  unsigned long n;
+
+  if (size < sizeof(struct snapshot_header)
+      || memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)))
+    return "not a snapshot";
+  if (h->version != SNAPSHOT_VERSION || h->header_size != sizeof(struct snapshot_header))
+    return "snapshot version not supported";
+  if (h->stack_size != STACK_SIZE || h->max_registers != MAX_REGISTERS)
+    return "snapshot is from a simulator with a different memory size";
+  if (h->size != size || h->strings_offset > size
+      || h->data_offset + STACK_SIZE * sizeof(int) > size
+      || h->watch_offset + STACK_SIZE > size
+      || h->breakpoint_offset + h->breakpoint_count * sizeof(struct snapshot_breakpoint) > size)
+    return "snapshot is truncated";
+  if (h->slots_used != m->slots_used || h->program_hash != program_hash(m))
+    return "snapshot is of a different program";
+  if (h->PC >= STACK_SIZE || h->nPC >= STACK_SIZE)
+    return "snapshot is damaged";
+
+  //each condition is a string that ends inside the file
+  sb = (struct snapshot_breakpoint *)(file + h->breakpoint_offset);
+  for (n = 0; n < h->breakpoint_count; n++) {
+    if (sb[n].cond < -1 || (sb[n].cond >= 0
+        && (h->strings_offset + sb[n].cond >= size
+            || !memchr(file + h->strings_offset + sb[n].cond, '\0',
+                       size - h->strings_offset - sb[n].cond))))
+      return "snapshot has a damaged breakpoint condition";
+  }
+  return NULL;
+}
+
+/*
+  Restores m from filename.  Returns 0, 1 if the file is not a usable
+  snapshot (with a message printed), or -1 with errno set.
+ */
+int snapshot_load(struct ami_machine *m, char *filename) {
+  struct snapshot_header *h;
+  struct snapshot_breakpoint *sb;
+  struct breakpoint *b, *next;
+  struct cond **conds;
+  struct stat st;
+  char *file, *error;
+  int fd, *data, i;
+  unsigned long n;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+  file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (file == MAP_FAILED)
+    return -1;
+
+  h = (struct snapshot_header *)file;
+  if ((error = snapshot_error(m, h, st.st_size))) {
+    printf("%s: %s\n", filename, error);
+    munmap(file, st.st_size);
+    return 1;
+  }
+
+  //compile the conditions before anything in m changes
+  sb = (struct snapshot_breakpoint *)(file + h->breakpoint_offset);
+  conds = calloc(h->breakpoint_count + 1, sizeof(struct cond *));
+  for (n = 0; n < h->breakpoint_count; n++) {
+    if (sb[n].cond >= 0 && !(conds[n] = cond_compile(file + h->strings_offset + sb[n].cond))) {
+      printf("%s: breakpoint condition '%s' does not compile\n", filename,
+             file + h->strings_offset + sb[n].cond);
+      while (n-- > 0)
+        cond_free(conds[n]);
+      free(conds);
+      munmap(file, st.st_size);
+      return 1;
+    }
+  }
+
+  memcpy(m->R, h->R, sizeof(m->R));
+  data = (int *)(file + h->data_offset);
+  for (i = 0; i < STACK_SIZE; i++)
+    if (m->mem[i].data_type == DATA)
+      m->mem[i].data = data[i];
+
+  memcpy(m->watch, file + h->watch_offset, STACK_SIZE);
+  m->watch_count = 0;
+  for (i = 0; i < STACK_SIZE; i++)
+    m->watch_count += m->watch[i] != 0;
+
+  for (b = m->breakpoints; b != NULL; b = next) {
+    next = b->next;
+    cond_free(b->cond);
+    free(b);
+  }
+  m->breakpoints = NULL;
+  //the list is saved newest first
+  for (n = h->breakpoint_count; n-- > 0; ) {
+    add_breakpoint(m, sb[n].addr, conds[n]);
+    m->breakpoints->enabled = sb[n].enabled;
+  }
+  free(conds);
+
+  //history restarts here, reverse execution stops at the restored state
+  history_reset(m);
+  m->PC = h->PC;
+  m->nPC = h->nPC;
+  m->halted = h->halted;
+  m->icount = h->icount;
+  m->console_io_status = h->console_io_status;
+  m->console_io_value = h->console_io_value;
+  munmap(file, st.st_size);
+
+  mark_breakpoint_blocks(m);
+  select_engine(m);
+  return 0;
+}
+
+static struct ami_machine *exit_machine;
+static char *exit_file;
+static pid_t exit_pid;
+
+static void save_at_exit(void) {
+  //children forked by 'explore' share the handler
+  if (getpid() != exit_pid)
+    return;
+  if (snapshot_save(exit_machine, exit_file) < 0)
+    perror(exit_file);
+}
+
+/*
+  Saves m to filename when the simulator exits, however it exits
+ */
+void snapshot_at_exit(struct ami_machine *m, char *filename) {
+  exit_machine = m;
+  exit_file = filename;
+  exit_pid = getpid();
+  atexit(save_at_exit);
+}
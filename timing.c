@@ -0,0 +1,222 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Pipeline timing model.  Estimates the cycles the executed
+  instructions would take on a classic in-order five stage pipeline
+  (IF ID EX MEM WB) that fetches one instruction per cycle and
+  assumes conditional jumps are not taken.  Instructions enter EX in
+  order; one waits there for:
+
+    read after write   a register it reads is written by an earlier
+                       instruction whose result is not ready yet
+    load use           as above, where the result comes from memory
+                       (a LOAD, or any operand in memory), which is
+                       only read in MEM
+    multi-cycle        MULT and DIV hold EX for several cycles
+    branch             a taken jump flushes the instructions fetched
+                       behind it; with a branch predictor on, only a
+                       mispredicted conditional jump does
+
+  With forwarding a result reaches EX in the cycle after it is
+  computed; without it, only after WB.  Data stalls are charged to
+  the instruction that waits, multi-cycle and branch stalls to the
+  instruction that causes them.
+
+  Like the cache model the timing model runs in the hooked engine,
+  so it costs nothing while off.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define MULT_CYCLES 4//cycles MULT holds EX
+#define DIV_CYCLES 12
+#define TAKEN_PENALTY 2//conditional jumps are resolved in EX
+#define JUMP_PENALTY 1//unconditional ones in ID
+#define FIRST_EX 3//cycle the first instruction reaches EX
+#define TIMING_REPORT_PCS 16
+
+static char *stall_names[] = {
+  "read after write", "load use", "multi-cycle", "branch"
+};
+
+struct timing *timing_create(int forwarding) {
+  struct timing *t = malloc(sizeof(struct timing));
+  if (!t)
+    return NULL;
+  t->forwarding = forwarding;
+  timing_clear(t);
+  return t;
+}
+
+void timing_clear(struct timing *t) {
+  int forwarding = t->forwarding;
+
+  memset(t, 0, sizeof(*t));
+  t->forwarding = forwarding;
+  t->next_ex = FIRST_EX;
+}
+
+/*
+  Notes the registers arg reads.  need becomes the first cycle all of
+  them are ready, and loaded whether the last one comes from memory.
+ */
+static void read_operand(struct timing *t, struct argument *arg,
+                         unsigned long *need, int *loaded) {
+  int i, r;
+
+  if (arg->type == REGISTER) {
+    r = arg->reg;
+    if (t->ready[r] > *need) {
+      *need = t->ready[r];
+      *loaded = t->loaded[r];
+    }
+  } else if (arg->type == ADDRESS) {
+    for (i = 0; i < arg->addc; i++) {
+      if (arg->add[i].type != REG)
+        continue;
+      r = arg->add[i].value;
+      if (t->ready[r] > *need) {
+        *need = t->ready[r];
+        *loaded = t->loaded[r];
+      }
+    }
+  }
+}
+
+static void stall(struct timing *t, unsigned int pc, int kind, unsigned long cycles) {
+  t->stalls[kind] += cycles;
+  if (pc < STACK_SIZE)
+    t->pc[pc].stalls[kind] += cycles;
+}
+
+/*
+  Accounts for entry, just executed at pc.  m->nPC tells whether a
+  conditional jump was taken.
+ */
+void timing_instruction(struct ami_machine *m, unsigned int pc, struct stack_entry *entry) {
+  struct timing *t = m->timing;
+  struct argument *args = entry->arguments;
+  unsigned long ex = t->next_ex, need = 0;
+  unsigned int i;
+  int loaded = 0, dest = -1, from_memory = entry->op == LOAD, occupancy = 1, penalty = 0;
+
+  switch (entry->op) {
+  case HALT:
+  case NOP:
+    break;
+  case WRITE:
+  case READB:
+  case READI:
+    read_operand(t, &args[0], &need, &loaded);
+    break;
+  case JUMP:
+    read_operand(t, &args[0], &need, &loaded);
+    penalty = JUMP_PENALTY;
+    break;
+  case JUMPIF:
+  case JUMPNIF:
+    read_operand(t, &args[0], &need, &loaded);
+    read_operand(t, &args[1], &need, &loaded);
+    if (m->bpred ? m->bpred->last_miss : m->nPC != pc + 1)
+      penalty = TAKEN_PENALTY;
+    break;
+  default:
+    if (args[0].type == REGISTER)
+      dest = args[0].reg;
+    else
+      read_operand(t, &args[0], &need, &loaded);
+    for (i = 1; i < entry->argc && i < 3; i++) {
+      read_operand(t, &args[i], &need, &loaded);
+      if (args[i].type == ADDRESS)
+        from_memory = 1;
+    }
+    if (entry->op == MULT)
+      occupancy = MULT_CYCLES;
+    else if (entry->op == DIV)
+      occupancy = DIV_CYCLES;
+  }
+
+  if (need > ex) {
+    stall(t, pc, loaded ? STALL_LOAD_USE : STALL_RAW, need - ex);
+    ex = need;
+  }
+  if (occupancy > 1)
+    stall(t, pc, STALL_MULTICYCLE, occupancy - 1);
+  if (penalty)
+    stall(t, pc, STALL_BRANCH, penalty);
+
+  //EX ends at ex + occupancy - 1, MEM and WB follow
+  if (dest >= 0) {
+    if (!t->forwarding)
+      t->ready[dest] = ex + occupancy + 2;
+    else
+      t->ready[dest] = ex + occupancy + from_memory;
+    t->loaded[dest] = from_memory;
+  }
+
+  t->next_ex = ex + occupancy + penalty;
+  t->cycles = ex + occupancy + 1;
+  t->instructions++;
+  if (pc < STACK_SIZE)
+    t->pc[pc].count++;
+}
+
+static struct timing *sort_timing;
+
+static unsigned long pc_stalls(struct timing *t, unsigned int pc) {
+  unsigned long sum = 0;
+  int k;
+  for (k = 0; k < STALL_KINDS; k++)
+    sum += t->pc[pc].stalls[k];
+  return sum;
+}
+
+//most stall cycles first
+static int compare_pcs(const void *a, const void *b) {
+  unsigned long sa = pc_stalls(sort_timing, *(const unsigned int *)a);
+  unsigned long sb = pc_stalls(sort_timing, *(const unsigned int *)b);
+  return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+void dump_timing(struct ami_machine *m) {
+  struct timing *t = m->timing;
+  unsigned int *pcs, n = 0, pc, i;
+  int k;
+
+  if (!t) {
+    printf("timing is off\n");
+    return;
+  }
+
+  printf("%lu cycles, %lu instructions, CPI %.2f (%s forwarding)\n", t->cycles,
+         t->instructions, t->instructions ? (double)t->cycles / t->instructions : 0.0,
+         t->forwarding ? "with" : "without");
+  for (k = 0; k < STALL_KINDS; k++)
+    printf("  %-17s %10lu stall cycles\n", stall_names[k], t->stalls[k]);
+
+  pcs = malloc(STACK_SIZE * sizeof(unsigned int));
+  if (!pcs)
+    return;
+  for (pc = 0; pc < STACK_SIZE; pc++)
+    if (pc_stalls(t, pc))
+      pcs[n++] = pc;
+  sort_timing = t;
+  qsort(pcs, n, sizeof(unsigned int), compare_pcs);
+
+  if (n > 0)
+    printf("\n  pc       count       raw  load use  multi-cycle    branch  instruction\n");
+  for (i = 0; i < n && i < TIMING_REPORT_PCS; i++) {
+    pc = pcs[i];
+    printf("%4u  %10lu  %8lu  %8lu  %11lu  %8lu  %s\n", pc, t->pc[pc].count,
+           t->pc[pc].stalls[STALL_RAW], t->pc[pc].stalls[STALL_LOAD_USE],
+           t->pc[pc].stalls[STALL_MULTICYCLE], t->pc[pc].stalls[STALL_BRANCH],
+           m->mem[pc].instruction ? m->mem[pc].instruction : "");
+  }
+  free(pcs);
+}
@@ -0,0 +1,113 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+static char *op_names[] = {
+  "halt", "write", "readb", "readi", "jumpif", "jumpnif", "jump",
+  "move", "idm", "load", "store", "eq", "neq", "lt", "lte", "and", "or",
+  "not", "add", "sub", "mult", "div", "neg", "nop"
+};
+
+char *opcode_name(unsigned int op) {
+  if (op < sizeof(op_names) / sizeof(op_names[0]))
+    return op_names[op];
+  return "???";
+}
+
+struct trace_buffer *trace_create(unsigned long size) {
+  unsigned long capacity = 1;
+
+  //round up to a power of two so the ring index is a mask
+  while (capacity < size)
+    capacity <<= 1;
+
+  struct trace_buffer *t = malloc(sizeof(struct trace_buffer));
+  if (!t)
+    return NULL;
+  t->records = calloc(capacity, sizeof(struct trace_record));
+  if (!t->records) {
+    free(t);
+    return NULL;
+  }
+  t->mask = capacity - 1;
+  t->head = 0;
+  return t;
+}
+
+void trace_free(struct trace_buffer *t) {
+  if (t) {
+    free(t->records);
+    free(t);
+  }
+}
+
+/*
+  Number of records currently held, and the index of the oldest
+ */
+static unsigned long trace_held(struct trace_buffer *t) {
+  return t->head > t->mask ? t->mask + 1 : t->head;
+}
+
+void trace_format(FILE *out, unsigned long seq, struct trace_record *r) {
+  fprintf(out, "%10lu  pc %4u  %-7s", seq, r->pc, opcode_name(r->op));
+  switch (r->kind) {
+  case TRACE_REG:
+    fprintf(out, "  r%u <- %d\n", r->dest, r->value);
+    break;
+  case TRACE_MEM:
+    fprintf(out, "  mem[%u] <- %d\n", r->dest, r->value);
+    break;
+  case TRACE_JUMP:
+    fprintf(out, "  -> %u\n", r->dest);
+    break;
+  default:
+    fprintf(out, "\n");
+  }
+}
+
+void trace_print(struct trace_buffer *t, FILE *out, unsigned long count) {
+  unsigned long held = trace_held(t), seq;
+
+  if (count == 0 || count > held)
+    count = held;
+
+  if (count == 0) {
+    fprintf(out, "trace is empty\n");
+    return;
+  }
+
+  for (seq = t->head - count; seq < t->head; seq++)
+    trace_format(out, seq, &t->records[seq & t->mask]);
+}
+
+/*
+  The saved trace is a fixed header followed by the held records,
+  oldest first, in host byte order.  tracedump renders it as text.
+ */
+int trace_save(struct trace_buffer *t, char *filename) {
+  struct trace_header h;
+  unsigned long held = trace_held(t), seq;
+
+  FILE *out = fopen(filename, "wb");
+  if (!out)
+    return -1;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+  h.version = TRACE_VERSION;
+  h.record_size = sizeof(struct trace_record);
+  h.first = t->head - held;
+  h.count = held;
+  fwrite(&h, sizeof(h), 1, out);
+
+  for (seq = h.first; seq < t->head; seq++)
+    fwrite(&t->records[seq & t->mask], sizeof(struct trace_record), 1, out);
+
+  return fclose(out);
+}
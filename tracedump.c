@@ -0,0 +1,54 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+// renders a trace written by the debugger's 'trace save' command as text
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+int main(int ac, char **av)
+{
+  struct trace_header h;
+  struct trace_record r;
+  unsigned long seq, skip = 0;
+
+  if (ac < 2 || ac > 3) {
+    printf("Usage: ./tracedump FILENAME {LAST}\n");
+    exit(1);
+  }
+
+  FILE *in = fopen(av[1], "rb");
+  if (!in) {
+    perror("Cannot open file"); exit(1);
+  }
+
+  if (fread(&h, sizeof(h), 1, in) != 1 || memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic))) {
+    printf("%s is not an AMI trace\n", av[1]);
+    exit(1);
+  }
+
+  if (h.version != TRACE_VERSION || h.record_size != sizeof(struct trace_record)) {
+    printf("%s has unsupported trace version %u\n", av[1], h.version);
+    exit(1);
+  }
+
+  if (ac == 3 && atol(av[2]) > 0 && atol(av[2]) < h.count) {
+    skip = h.count - atol(av[2]);
+    fseek(in, skip * sizeof(struct trace_record), SEEK_CUR);
+  }
+
+  for (seq = h.first + skip; seq < h.first + h.count; seq++) {
+    if (fread(&r, sizeof(r), 1, in) != 1) {
+      printf("trace truncated after %lu records\n", seq - h.first);
+      exit(1);
+    }
+    trace_format(stdout, seq, &r);
+  }
+
+  fclose(in);
+  return 0;
+}
@@ -0,0 +1,168 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Load-time verification.  Every check on an instruction that depends
+  only on the instruction itself -- operand counts and types, and
+  jump targets that are constants -- is made here once, after the
+  program is loaded.  A program that passes runs on an engine that
+  skips those checks; what is left in the engine depends on values
+  only known at run time (computed addresses and jump targets,
+  division by zero).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+static char *op_labels[] = {
+  "HALT", "WRITE", "READB", "READI", "JUMPIF", "JUMPNIF", "JUMP",
+  "MOVE", "IDM", "LOAD", "STORE", "EQ", "NEQ", "LT", "LTE", "AND", "OR",
+  "NOT", "ADD", "SUB", "MULT", "DIV", "NEG", "NOP"
+};
+
+static int is_value(struct argument *arg) {
+  return arg->type == REGISTER || arg->type == ADDRESS;
+}
+
+/*
+  A jump target is a constant if it is a number or an address with
+  no register parts
+ */
+int constant_target(struct argument *arg, int *target) {
+  int i, sum = 0;
+
+  if (arg->type == NUMBER) {
+    *target = arg->number;
+    return 1;
+  }
+  if (arg->type != ADDRESS)
+    return 0;
+
+  for (i = 0; i < arg->addc; i++) {
+    if (arg->add[i].type == REG)
+      return 0;
+    sum += arg->add[i].value;
+  }
+  *target = sum;
+  return 1;
+}
+
+static char *jump_error(struct ami_machine *m, struct stack_entry *e) {
+  int target;
+
+  if (constant_target(&e->arguments[0], &target)
+      && (target < 0 || target >= m->slots_used))
+    return "Attempted to jump past instructions in stack";
+  if (e->op != JUMP && !is_value(&e->arguments[1]))
+    return "Non register/address argument supplied";
+  return NULL;
+}
+
+/*
+  Returns why e cannot be executed, or NULL if it is well formed.
+  The messages are the ones the engine used to raise when it found
+  the same problem while running.
+ */
+char *instruction_error(struct ami_machine *m, struct stack_entry *e) {
+  static char message[64];
+  struct argument *args = e->arguments;
+  int argc = 3;
+
+  switch (e->op) {
+  case ILLEGAL:
+    return e->error;
+  case HALT:
+  case NOP:
+    return NULL;
+  case WRITE:
+    return is_value(&args[0]) ? NULL : "Non register/address argument supplied";
+  case READB:
+  case READI:
+    if (e->argc != 1 || args[0].type != ADDRESS) {
+      snprintf(message, sizeof(message), "Non address destination for %s", op_labels[e->op]);
+      return message;
+    }
+    return NULL;
+  case JUMP:
+  case JUMPIF:
+  case JUMPNIF:
+    return jump_error(m, e);
+  case MOVE:
+    if (!is_value(&args[0]))
+      return "Inappropriate destination for move";
+    return is_value(&args[1]) ? NULL : "Non register/address argument supplied";
+  case LOAD:
+    if (e->argc != 2 || args[0].type != REGISTER || args[1].type != ADDRESS)
+      return "Inappropriate destination for load";
+    return NULL;
+  case STORE:
+    if (e->argc != 2 || args[0].type != ADDRESS || args[1].type != REGISTER)
+      return "Inappropriate destination for store";
+    return NULL;
+  case IDM:
+    if (args[1].type != NUMBER)
+      return "Inappropriate number for immediate data move";
+    if (!is_value(&args[0]))
+      return "Inappropriate destination for immediate data move";
+    return NULL;
+  case EQ:
+  case NEQ:
+  case LT:
+  case LTE:
+    if (e->argc != 3 || args[0].type != REGISTER) {
+      snprintf(message, sizeof(message), "Non register argument in %s instruction", op_labels[e->op]);
+      return message;
+    }
+    break;
+  case NOT:
+  case NEG:
+    argc = 2;
+    //fall through
+  case AND:
+  case OR:
+  case ADD:
+  case SUB:
+  case MULT:
+  case DIV:
+    if (e->argc != argc) {
+      snprintf(message, sizeof(message), "Wrong number of arguments for %s", op_labels[e->op]);
+      return message;
+    }
+    if (!is_value(&args[0])) {
+      snprintf(message, sizeof(message), "Inappropriate destination for %s", op_labels[e->op]);
+      return message;
+    }
+    break;
+  default:
+    return "Unknown opcode";
+  }
+
+  //the remaining operations read every argument after the destination
+  if (!is_value(&args[1]) || (argc == 3 && !is_value(&args[2])))
+    return "Non register/address argument supplied";
+  return NULL;
+}
+
+/*
+  Checks every loaded instruction, printing one diagnostic per bad
+  instruction with its line in the source file.  Returns the number
+  of bad instructions.
+ */
+int verify_program(struct ami_machine *m) {
+  int i, errors = 0;
+  char *error;
+
+  for (i = 0; i < m->slots_used; i++) {
+    if ((error = instruction_error(m, &m->mem[i]))) {
+      printf("%s:%u: %s\n    %s\n", m->filename, m->mem[i].line, error,
+             m->mem[i].instruction);
+      errors++;
+    }
+  }
+
+  return errors;
+}
@@ -0,0 +1,267 @@
+// Copyright (c) 2015, Sam Silberstein.  All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License").
+// Author: smsilb14@g.holycross.edu
+
+/*
+  Bounds on runs.  Inside run() ('continue' and 'step') a run ends
+  with RUN_BREAK when
+
+    - it has executed 'limit steps' instructions
+    - it has taken 'limit time' seconds of wall-clock time
+    - the user presses Ctrl-C
+    - with 'loops on', the program is back in a state it was in at
+      an earlier backward jump, so it would go round forever
+
+  The engine only looks at these between blocks, when icount passes
+  m->next_check; the Ctrl-C handler sets next_check to 0 to be seen
+  at once, and the clock is read every LIMIT_CLOCK_INTERVAL
+  instructions.  Runs made by _run() alone (reverse execution
+  replays, benchmarks, explore) only stop for Ctrl-C.
+
+  Loop detection is Brent's cycle finding over the states at
+  backward jumps: the PC, the registers and the memory written
+  during the run.  A state is saved after 1, 2, 4, ... further
+  jumps and each jump's state is compared with the saved one,
+  first by hash and then exactly, so a repeat is found within about
+  twice the jumps it takes to enter the loop and go round it once.
+  Reading input makes the future depend on more than the state, so
+  it starts the search over.  The detector works in the hooked
+  engine, which it selects.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+//<signal.h> declares a raise() that clashes with sim.h's
+#define raise signal_raise
+#include <signal.h>
+#undef raise
+
+#include "sim.h"
+
+#define LIMIT_CLOCK_INTERVAL 65536//instructions between looks at the clock
+
+static struct ami_machine *interrupt_machine;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void on_interrupt(int sig) {
+  struct ami_machine *m = interrupt_machine;
+
+  //outside a run Ctrl-C ends the simulator as it always did
+  if (!m->running) {
+    signal(SIGINT, SIG_DFL);
+    kill(getpid(), SIGINT);
+    return;
+  }
+  m->stop = STOP_INTERRUPT;
+  m->next_check = 0;
+}
+
+/*
+  Makes Ctrl-C stop the run in progress on m
+ */
+void catch_interrupts(struct ami_machine *m) {
+  struct sigaction sa;
+
+  interrupt_machine = m;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_interrupt;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+}
+
+static void set_next_check(struct ami_machine *m) {
+  unsigned long next = ULONG_MAX;
+
+  if (m->max_steps)
+    next = m->stop_icount;
+  if (m->max_seconds > 0 && m->icount + LIMIT_CLOCK_INTERVAL < next)
+    next = m->icount + LIMIT_CLOCK_INTERVAL;
+  m->next_check = next;
+}
+
+/*
+  Starts applying the limits to m.  Calls nest; only the outermost
+  start and stop count.
+ */
+void limits_start(struct ami_machine *m) {
+  if (m->guarded++)
+    return;
+  m->stop = STOP_NONE;
+  m->stop_icount = m->icount + m->max_steps;
+  m->deadline = now() + m->max_seconds;
+  if (m->loops)
+    loop_reset(m);
+  set_next_check(m);
+}
+
+void limits_stop(struct ami_machine *m) {
+  if (m->guarded == 0 || --m->guarded)
+    return;
+  m->next_check = ULONG_MAX;
+}
+
+/*
+  Called by the engine between blocks once icount reaches
+  m->next_check.  Returns 1 if the run should end.
+ */
+int run_check(struct ami_machine *m) {
+  if (!m->guarded) {
+    m->next_check = ULONG_MAX;
+    //nothing will show the stop, so it must not outlive this run
+    if (m->stop == STOP_INTERRUPT) {
+      m->stop = STOP_NONE;
+      return 1;
+    }
+    return 0;
+  }
+  if (!m->stop && m->max_steps && m->icount >= m->stop_icount)
+    m->stop = STOP_STEPS;
+  if (!m->stop && m->max_seconds > 0 && now() >= m->deadline)
+    m->stop = STOP_TIME;
+  if (m->stop)
+    return 1;
+  set_next_check(m);
+  return 0;
+}
+
+/*
+  Says why the last run ended with RUN_BREAK
+ */
+void show_stop(struct ami_machine *m) {
+  switch (m->stop) {
+  case STOP_INTERRUPT:
+    printf("interrupted at pc %u\n", m->PC);
+    break;
+  case STOP_STEPS:
+    printf("instruction limit of %lu reached at pc %u\n", m->max_steps, m->PC);
+    break;
+  case STOP_TIME:
+    printf("time limit of %g seconds reached at pc %u\n", m->max_seconds, m->PC);
+    break;
+  case STOP_LOOP:
+    printf("infinite loop: the state at pc %u repeats every %lu instructions\n", m->PC,
+           m->loops->period);
+    break;
+  }
+  m->stop = STOP_NONE;
+}
+
+void dump_limits(struct ami_machine *m) {
+  if (m->max_steps)
+    printf("runs stop after %lu instructions\n", m->max_steps);
+  else
+    printf("no instruction limit\n");
+  if (m->max_seconds > 0)
+    printf("runs stop after %g seconds\n", m->max_seconds);
+  else
+    printf("no time limit\n");
+  printf("loop detection is %s\n", m->loops ? "on" : "off");
+}
+
+int set_loop_detection(struct ami_machine *m, int on) {
+  if (!on) {
+    free(m->loops);
+    m->loops = NULL;
+  } else if (!m->loops) {
+    m->loops = malloc(sizeof(struct loop_detector));
+    if (!m->loops) {
+      printf("out of memory\n");
+      return -1;
+    }
+    loop_reset(m);
+  }
+  select_engine(m);
+  return 0;
+}
+
+void loop_reset(struct ami_machine *m) {
+  struct loop_detector *d = m->loops;
+
+  d->saved = 0;
+  d->jumps = 0;
+  d->power = 1;
+  d->written_count = 0;
+  memset(d->dirty, 0, sizeof(d->dirty));
+}
+
+void loop_write(struct ami_machine *m, unsigned int addr) {
+  struct loop_detector *d = m->loops;
+
+  if (addr < STACK_SIZE && !(d->dirty[addr >> 3] & (1 << (addr & 7)))) {
+    d->dirty[addr >> 3] |= 1 << (addr & 7);
+    d->written[d->written_count++] = addr;
+  }
+}
+
+//FNV-1a
+static unsigned long mix(unsigned long h, int value) {
+  int i;
+  for (i = 0; i < sizeof(int); i++) {
+    h ^= (value >> (8 * i)) & 0xff;
+    h *= 1099511628211UL;
+  }
+  return h;
+}
+
+static unsigned long state_hash(struct ami_machine *m, unsigned int pc) {
+  struct loop_detector *d = m->loops;
+  unsigned long h = mix(14695981039346656037UL, pc);
+  unsigned int i;
+
+  for (i = 0; i < m->reg_count; i++)
+    h = mix(h, m->R[i]);
+  for (i = 0; i < d->written_count; i++)
+    h = mix(h, m->mem[d->written[i]].data);
+  return h;
+}
+
+//slots not written since the search started are the same in both
+static int same_state(struct ami_machine *m, unsigned int pc) {
+  struct loop_detector *d = m->loops;
+  unsigned int i;
+
+  if (pc != d->PC || memcmp(m->R, d->R, m->reg_count * sizeof(int)))
+    return 0;
+  for (i = 0; i < d->written_count; i++)
+    if (m->mem[d->written[i]].data != d->data[d->written[i]])
+      return 0;
+  return 1;
+}
+
+/*
+  Called by the hooked engine for a jump from m->PC back to m->nPC
+ */
+void loop_jump(struct ami_machine *m) {
+  struct loop_detector *d = m->loops;
+  unsigned long hash = state_hash(m, m->nPC);
+  unsigned int i;
+
+  if (d->saved && hash == d->hash && same_state(m, m->nPC)) {
+    d->period = m->icount - d->icount;
+    m->stop = STOP_LOOP;
+    m->next_check = 0;
+    return;
+  }
+  if (d->saved && ++d->jumps < d->power)
+    return;
+
+  d->saved = 1;
+  d->power = d->jumps ? 2 * d->power : 1;
+  d->jumps = 0;
+  d->hash = hash;
+  d->icount = m->icount;
+  d->PC = m->nPC;
+  memcpy(d->R, m->R, sizeof(d->R));
+  for (i = 0; i < STACK_SIZE; i++)
+    d->data[i] = m->mem[i].data;
+}